@@ -37,9 +37,22 @@ my $red = "\e[31m";
 my $off = "\e[0m";
 
 my %test_results = ();
+my %test_cycles = ();
 
 my $total_bytes = 0;
 
+# Build options for json65.s, which leave out features to save space
+# (and time).  The main test is built with each one, and adjusts what
+# it expects accordingly.
+my @profiles = (
+    ["nopos", "J65_NO_POSITIONS"],
+    ["nouni", "J65_NO_UNICODE_ESCAPES"],
+    ["int16", "J65_INT16"],
+    ["noint", "J65_NO_INTEGER_CONVERSION"],
+    ["min",   "J65_NO_POSITIONS", "J65_NO_UNICODE_ESCAPES",
+              "J65_NO_INTEGER_CONVERSION"],
+);
+
 sub mysystem {
     my @cmd = @_;
     print join(" ", @cmd), "\n";
@@ -54,21 +67,6 @@ sub mysystem {
     }
 }
 
-sub mysystem_nonfatal {
-    my @cmd = @_;
-    print join(" ", @cmd), "\n";
-    if (system (@cmd) != 0) {
-        if ($? == -1) {
-            die "$red*** fatal: $!$off\n";
-        } elsif ($? & 127) {
-            die (sprintf ("$red*** fatal: signal %d$off\n", $? & 127));
-        } else {
-            return "fail";
-        }
-    }
-    return "pass";
-}
-
 sub print_heading {
     my $str = $_[0];
     print "$blue*** $str$off\n";
@@ -82,9 +80,15 @@ sub build_program {
     my $target = "sim6502";
     $target = $hash->{"target"} if (exists $hash->{"target"});
 
-    my @cmd = ("cl65", "-I$src", "-W-unused-param", "-O");
+    my @cmd = ("cl65", "-I$src", "--asm-include-dir", $src,
+               "-W-unused-param", "-O");
     push @cmd, '-t', $target;
     push @cmd, '-C', $hash->{"config"} if (exists $hash->{"config"});
+    if (exists $hash->{"defines"}) {
+        foreach my $def (@{$hash->{"defines"}}) {
+            push @cmd, '-D', $def, '--asm-define', $def;
+        }
+    }
     push @cmd, '-o', $prog;
     push @cmd, '-m', $map;
     push @cmd, @sources;
@@ -94,9 +98,20 @@ sub build_program {
 
 sub run_test {
     my $t = $_[0];
+    my @cmd = ("sim65", "-c", $t);
 
     print_heading "Running $t";
-    $test_results{$t} = mysystem_nonfatal ("sim65", $t);
+    print join(" ", @cmd), "\n";
+    open my $out, "-|", @cmd or die "$red*** fatal: $!$off\n";
+    while (<$out>) {
+        print;
+        $test_cycles{$t} = $1 if (/^(\d+) cycles$/);
+    }
+    close $out;
+    if ($? & 127) {
+        die (sprintf ("$red*** fatal: signal %d$off\n", $? & 127));
+    }
+    $test_results{$t} = ($? == 0) ? "pass" : "fail";
 }
 
 sub parse_map {
@@ -148,6 +163,22 @@ build_program({'prog' => "$test/test-print"},
               "$src/json65.s", "$src/json65-string.s", "$src/json65-tree.c",
               "$src/json65-quote.s", "$src/json65-print.c",
               "$test/test-print.c");
+foreach my $profile (@profiles) {
+    my ($name, @defines) = @$profile;
+    build_program({'prog' => "$test/test-$name", 'defines' => \@defines},
+                  "$src/json65.s", "$test/test.c");
+}
+
+# The same tests again, for the 65C02, to see how many cycles the
+# 65C02 instructions save
+build_program({'prog' => "$test/test-c02", 'target' => 'sim65c02'},
+              "$src/json65.s", "$test/test.c");
+build_program({'prog' => "$test/test-string-c02", 'target' => 'sim65c02'},
+              "$src/json65-string.s", "$test/test-string.c");
+build_program({'prog' => "$test/test-print-c02", 'target' => 'sim65c02'},
+              "$src/json65.s", "$src/json65-string.s", "$src/json65-tree.c",
+              "$src/json65-quote.s", "$src/json65-print.c",
+              "$test/test-print.c");
 
 # test-file uses library functions (ftell and fseek) which are not available
 # on sim65, so we build it for Apple II instead.  This means that we cannot
@@ -172,6 +203,12 @@ run_test ("test");
 run_test ("test-string");
 run_test ("test-tree");
 run_test ("test-print");
+foreach my $profile (@profiles) {
+    run_test ("test-" . $profile->[0]);
+}
+run_test ("test-c02");
+run_test ("test-string-c02");
+run_test ("test-print-c02");
 
 # test-quote is not self-checking, and its functionality is subsumed
 # by test-print, so there's no need to run it
@@ -190,11 +227,33 @@ print_size ($print_map, "json65-print.o");
 print_size ($file_map,  "json65-file.o");
 printf "%-15s %4u bytes\n", "total", $total_bytes;
 
+print_heading "json65.o size for each build option";
+
+printf "%-15s %4u bytes\n", "(none)", $print_map->{"json65.o"};
+foreach my $profile (@profiles) {
+    my ($name, @defines) = @$profile;
+    my $map = parse_map ("test-$name.map");
+    printf "%-15s %4u bytes  %s\n", $name, $map->{"json65.o"},
+        join (" ", @defines);
+}
+
+print_heading "65C02 cycles";
+
+printf "%-15s %9s  %9s\n", "", "6502", "65C02";
+
+foreach my $t ("test", "test-string", "test-print") {
+    my $c02 = "$t-c02";
+    next unless (exists $test_cycles{$t} and exists $test_cycles{$c02});
+    my $diff = $test_cycles{$c02} - $test_cycles{$t};
+    printf "%-15s %9u  %9u  %+9d (%+.1f%%)\n", $t, $test_cycles{$t},
+        $test_cycles{$c02}, $diff, 100 * $diff / $test_cycles{$t};
+}
+
 my $failures = 0;
 
 print_heading "Test summary";
 foreach my $t (sort keys %test_results) {
-    printf "%-11s ", $t;
+    printf "%-15s ", $t;
     if ($test_results{$t} eq "pass") {
         print $green, "PASS", $off, "\n";
     } else {
@@ -33,12 +33,13 @@ static const char *get_errmsg (int8_t n) {
     case J65_PARSE_ERROR:        return "parse error";
     case J65_ILLEGAL_CHAR:       return "illegal character";
     case J65_ILLEGAL_ESCAPE:     return "illegal escape sequence";
-    case J65_STRING_TOO_LONG:    return "string longer than 255 bytes";
+    case J65_STRING_TOO_LONG:    return "string too long";
     case J65_EXPECTED_STRING:    return "keys must be strings";
     case J65_EXPECTED_COLON:     return "expected ':'";
     case J65_EXPECTED_COMMA:     return "expected ','";
     case J65_EXPECTED_OBJ_END:   return "expected '}'";
     case J65_EXPECTED_ARRAY_END: return "expected ']'";
+    case J65_ILLEGAL_UTF8:       return "illegal UTF-8";
     default: return NULL;
     }
 }
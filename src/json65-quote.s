@@ -22,6 +22,7 @@
 
         .macpack generic
         .include "zeropage.inc"
+        .include "json65-macros.inc"
 
         .import _fprintf
         .import _fputc
@@ -79,7 +80,7 @@ loop2:  lda (strptr),y
         bne special_char
 okay_char:                      ; character does not need to be escaped
         iny
-        jmp loop2
+        jra loop2
 higher: cmp #$5c                ; backslash
         bne okay_char
 special_char:                   ; character needs to be escaped
@@ -146,7 +147,7 @@ found_short_escape:
         lda fileptr             ; argument "f" passed in ax
         ldx fileptr+1
         jsr _fputc
-        jmp continue
+        jra continue
 done:   restore_regbank
         rts
 
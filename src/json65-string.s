@@ -22,6 +22,7 @@
 
         .macpack generic
         .include "zeropage.inc"
+        .include "json65-macros.inc"
 
         .import _free
         .import _malloc
@@ -120,13 +121,19 @@ strloop:
         ldx tmpptr+1
 fail:   rts
 nextlink:
+.ifpc02
+        lda (linkptr)
+        tax
+        ldy #1
+.else
         ldy #0
         lda (linkptr),y
         tax
         iny
+.endif
         lda (linkptr),y
         stx linkptr
-        jmp linkloop
+        jra linkloop
 not_found:                      ; so we need to add it to the hash table
         ldx #0
         lda len
@@ -167,7 +174,7 @@ copyloop:
         lda (strptr),y
         sta (tmpptr),y
         iny
-        jmp copyloop
+        jra copyloop
 copydone:
         lda #0
         sta (tmpptr),y
@@ -196,7 +203,7 @@ loop:   sta t1
         rotate_left
         rotate_left
         rotate_left
-        jmp loop
+        jra loop
 done0:  dey
 done:   lda t1
         rts
@@ -234,10 +241,16 @@ loop:   sty idx
         stx linkptr+1
         ora linkptr+1
         beq done
+.ifpc02
+        lda (linkptr)
+        sta t1
+        ldy #1
+.else
         ldy #0
         lda (linkptr),y
         sta t1
         iny
+.endif
         lda (linkptr),y
         sta t2
         lda linkptr
@@ -245,6 +258,6 @@ loop:   sty idx
         jsr _free
         lda t1
         ldx t2
-        jmp freelink
+        jra freelink
 done:   rts
 .endproc                ; freelink
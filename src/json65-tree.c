@@ -23,28 +23,211 @@
 */
 
 #include <stdbool.h>
+#include <stddef.h>             /* offsetof */
 #include <stdlib.h>             /* malloc and free */
+#include <string.h>             /* memset */
 #include "json65-tree.h"
 
+/* j65_find_key() indexes an object once a search passes this many keys */
+#define INDEX_THRESHOLD 16
+
+/* an open-addressing hash table of an object's key nodes, keyed by
+   the (interned) string pointer.  mask + 1 slots, a power of 2. */
+struct j65_key_index {
+    size_t mask;
+    j65_node *slots[1];
+};
+
 typedef struct {
     j65_strings strings;
     j65_node *root;
     j65_node *current;
     bool add_child;
+    j65_arena *arena;
+    uint8_t locations;
+    j65_record_callback record_cb;
+    uint8_t record_depth;
+    uint8_t depth;              /* number of open arrays and objects */
+    j65_arena *mark_arena;      /* where the current record started */
+    size_t mark_used;
 } j65_tree_internal;
 
+/* indexed by j65_locations */
+static const uint8_t node_sizes[] = {
+    sizeof (j65_node),
+    offsetof (j65_node, offset) + sizeof (uint32_t),
+    offsetof (j65_node, offset),
+};
+
 void __fastcall__ j65_init_tree (j65_tree *t) {
+    j65_init_tree_arena (t, NULL);
+}
+
+void __fastcall__ j65_init_tree_arena (j65_tree *t, j65_arena *arena) {
     j65_tree_internal *tree = (j65_tree_internal *) t;
     j65_init_strings (&tree->strings);
     tree->root = NULL;
     tree->current = NULL;
     tree->add_child = true;
+    tree->arena = arena;
+    tree->locations = J65_LOCATIONS_FULL;
+    tree->record_cb = NULL;
+    tree->record_depth = 0;
+    tree->depth = 0;
+}
+
+void __fastcall__ j65_set_tree_locations (j65_tree *t, uint8_t locations) {
+    j65_tree_internal *tree = (j65_tree_internal *) t;
+    tree->locations = locations;
+}
+
+void __fastcall__ j65_set_tree_records (j65_tree *t, uint8_t depth,
+                                        j65_record_callback cb) {
+    j65_tree_internal *tree = (j65_tree_internal *) t;
+    /* a record at depth 0 would have no parent to be detached from */
+    if (depth == 0)
+        depth = 1;
+    tree->record_depth = depth;
+    tree->record_cb = cb;
+}
+
+size_t __fastcall__ j65_node_size (uint8_t locations) {
+    return node_sizes[locations];
+}
+
+void __fastcall__ j65_find_location (const char *buf, uint32_t offset,
+                                     j65_source_location *loc) {
+    uint32_t i;
+    char c, last = 0;
+
+    loc->line_offset = 0;
+    loc->line_number = 0;
+
+    for (i = 0; i < offset; i++) {
+        c = buf[i];
+        if (c == '\r' || c == '\n') {
+            /* LF immediately after CR doesn't start another line */
+            if (c == '\r' || last != '\r')
+                loc->line_number++;
+            loc->line_offset = i + 1;
+        }
+        last = c;
+    }
+
+    loc->column_number = offset - loc->line_offset;
+}
+
+void __fastcall__ j65_init_arena (j65_arena *a, void *mem, size_t size) {
+    a->mem = (uint8_t *) mem;
+    a->size = size;
+    a->used = 0;
+    a->next = NULL;
+}
+
+void __fastcall__ j65_reset_arena (j65_arena *a) {
+    while (a != NULL) {
+        a->used = 0;
+        a = a->next;
+    }
+}
+
+/* allocates from the last arena in the chain which is in use, or
+   from the ones after it, so that the arenas fill up in order, and
+   everything allocated after a mark comes after it */
+static void *arena_alloc (j65_arena *a, size_t size) {
+    void *ret;
+
+    while (a != NULL) {
+        if ((a->next == NULL || a->next->used == 0) &&
+            a->size - a->used >= size) {
+            ret = a->mem + a->used;
+            a->used += size;
+            return ret;
+        }
+        a = a->next;
+    }
+
+    return NULL;
+}
+
+/* allocates from the tree's arena, if it has one, or else with malloc */
+static void *tree_alloc (j65_tree_internal *tree, size_t size) {
+    if (tree->arena != NULL)
+        return arena_alloc (tree->arena, size);
+    return malloc (size);
+}
+
+/* frees the nodes in the subtree rooted at n, whose parent must be NULL */
+static void free_nodes (j65_node *n, bool copied_strings) {
+    j65_node *follow;
+
+    /* traverse the entire tree without recursion */
+    /* (since 6502 stack is limited) */
+    while (n != NULL) {
+        switch (n->node_type) {
+        case J65_KEY:
+        case J65_START_OBJ:
+        case J65_START_ARRAY:
+            follow = n->child;
+            n->child = NULL;
+            if (follow != NULL)
+                break;
+            /* fall thru */
+        default:
+            /* node has no children (either a leaf or empty container) */
+            follow = n->next;
+            if (follow == NULL) /* no remaining siblings, either */
+                follow = n->parent;
+            if (n->node_type == J65_START_OBJ)
+                free (n->index);
+            else if (n->node_type == J65_START_ARRAY)
+                free (n->elements);
+            else if (copied_strings && (n->node_type == J65_STRING ||
+                                        n->node_type == J65_NUMBER))
+                free ((char *) n->string);
+            free (n);
+        }
+        n = follow;
+    }
+}
+
+/* called when a value is complete.  if it completes a record, hands
+   the record to the record callback, and then frees it. */
+static int8_t end_value (j65_tree_internal *tree) {
+    j65_node *record = tree->current;
+    j65_node *container;
+    int8_t ret;
+
+    if (tree->record_cb == NULL || tree->depth != tree->record_depth)
+        return 0;
+
+    ret = tree->record_cb ((j65_tree *) tree, record);
+
+    /* records are always the only child, since each one is freed
+       before the next one starts */
+    container = record->parent;
+    container->child = NULL;
+    tree->current = container;
+    tree->add_child = true;
+
+    if (tree->arena != NULL) {
+        tree->mark_arena->used = tree->mark_used;
+        j65_reset_arena (tree->mark_arena->next);
+    } else {
+        record->parent = NULL;
+        free_nodes (record, true);
+    }
+
+    return ret;
 }
 
 int8_t __fastcall__ j65_tree_callback (j65_parser *p, uint8_t event) {
     j65_tree_internal *tree = (j65_tree_internal *) j65_get_context (p);
     const char *str = NULL;
     j65_node *n;
+    j65_node *parent;
+    j65_arena *a;
+    uint8_t len;
 
     switch (event) {
     case J65_END_OBJ:
@@ -58,31 +241,68 @@ int8_t __fastcall__ j65_tree_callback (j65_parser *p, uint8_t event) {
             tree->current->parent->node_type == J65_KEY) {
             tree->current = tree->current->parent;
         }
-        return 0;
+        tree->depth--;
+        return end_value (tree);
+    }
+
+    if (tree->add_child)
+        parent = tree->current;
+    else
+        parent = tree->current->parent;
+
+    /* a new record is starting, so remember where it starts in the
+       arena, to free it later */
+    if (tree->record_cb != NULL && tree->arena != NULL &&
+        tree->depth == tree->record_depth && parent->node_type != J65_KEY) {
+        a = tree->arena;
+        while (a->next != NULL && a->next->used != 0)
+            a = a->next;
+        tree->mark_arena = a;
+        tree->mark_used = a->used;
+    }
+
+    switch (event) {
     case J65_NUMBER:
     case J65_STRING:
+        if (tree->record_cb != NULL) {
+            /* not interned, so that it can be freed with its record */
+            len = j65_get_length (p);
+            str = (const char *) tree_alloc (tree, len + 1);
+            if (str == NULL)
+                return J65_OUT_OF_MEMORY;
+            memcpy ((char *) str, j65_get_string (p), len + 1);
+            break;
+        }
+        /* fall thru */
     case J65_KEY:
         str = j65_intern_string (&tree->strings, j65_get_string (p));
         if (str == NULL)
             return J65_OUT_OF_MEMORY;
     }
 
-    n = (j65_node *) malloc (sizeof (j65_node));
+    n = (j65_node *) tree_alloc (tree, node_sizes[tree->locations]);
     if (n == NULL)
         return J65_OUT_OF_MEMORY;
 
     n->node_type = event;
-    n->location.line_offset = j65_get_line_offset (p);
-    n->location.line_number = j65_get_line_number (p);
-    n->location.column_number = j65_get_column_number (p);
+    switch (tree->locations) {
+    case J65_LOCATIONS_FULL:
+        n->location.line_offset = j65_get_line_offset (p);
+        n->location.line_number = j65_get_line_number (p);
+        n->location.column_number = j65_get_column_number (p);
+        break;
+    case J65_LOCATIONS_OFFSET:
+        n->offset = j65_get_line_offset (p) + j65_get_column_number (p);
+        break;
+    }
 
-    if (tree->add_child)
-        n->parent = tree->current;
-    else
-        n->parent = tree->current->parent;
+    n->parent = parent;
     n->next = NULL;
 
-    n->integer = 0;           /* clears all fields of union to NULL */
+    n->integer = 0;           /* clears string (or index) and child */
+    n->count = 0;
+    if (n->parent != NULL)
+        n->parent->count++;
 
     switch (event) {
     case J65_INTEGER:
@@ -113,32 +333,115 @@ int8_t __fastcall__ j65_tree_callback (j65_parser *p, uint8_t event) {
 
     switch (event) {
     case J65_KEY:
+        tree->add_child = true;
+        break;
     case J65_START_OBJ:
     case J65_START_ARRAY:
         tree->add_child = true;
+        tree->depth++;
         break;
     default:
         tree->add_child = false;
-        break;
+        return end_value (tree);
     }
 
     return 0;
 }
 
+/* true if container is an array or object which the parser has not
+   finished with, so that children may still be added to it (or, in
+   record-at-a-time mode, be freed).  such containers are not indexed,
+   since an index would soon be out of date, and in an arena, it would
+   be freed along with the current record. */
+static bool still_open (j65_tree_internal *tree, const j65_node *container) {
+    j65_node *n = tree->current;
+
+    if (n != NULL && !tree->add_child)
+        n = n->parent;
+
+    for ( ; n != NULL; n = n->parent) {
+        if (n == container)
+            return true;
+    }
+
+    return false;
+}
+
+static size_t hash_key (const char *key, size_t mask) {
+    size_t h = (size_t) key;
+    return (h ^ (h >> 8)) & mask;
+}
+
+/* on failure, the object is left without an index */
+static void build_index (j65_tree_internal *tree, j65_node *object) {
+    j65_node *n;
+    j65_key_index *index;
+    size_t count = object->count;
+    size_t size = INDEX_THRESHOLD * 2;
+    size_t bytes, i;
+
+    while (size < count + count / 2) /* keep it at most 2/3 full */
+        size <<= 1;
+
+    bytes = sizeof (j65_key_index) + (size - 1) * sizeof (j65_node *);
+    index = (j65_key_index *) tree_alloc (tree, bytes);
+    if (index == NULL)
+        return;
+
+    memset (index->slots, 0, size * sizeof (j65_node *));
+    index->mask = size - 1;
+
+    for (n = object->child; n != NULL; n = n->next) {
+        i = hash_key (n->string, index->mask);
+        while (index->slots[i] != NULL && index->slots[i]->string != n->string)
+            i = (i + 1) & index->mask;
+        if (index->slots[i] == NULL) /* first duplicate key wins */
+            index->slots[i] = n;
+    }
+
+    object->index = index;
+}
+
 j65_node * __fastcall__ j65_find_key (j65_tree *t,
                                       j65_node *object,
                                       const char *key) {
+    j65_tree_internal *tree = (j65_tree_internal *) t;
     const char *k = j65_intern_string (&t->strings, key);
+    j65_node *n;
+    size_t count = 0;
 
     if (k == NULL)
         return NULL;
 
-    return j65_find_interned_key (object, k);
+    if (object->node_type != J65_START_OBJ || object->index != NULL)
+        return j65_find_interned_key (object, k);
+
+    /* no index yet; build one if this object turns out to be large */
+    for (n = object->child; n != NULL && n->string != k; n = n->next)
+        count++;
+    if (count >= INDEX_THRESHOLD && !still_open (tree, object))
+        build_index (tree, object);
+
+    return n;
 }
 
 j65_node * __fastcall__ j65_find_interned_key (j65_node *object,
                                                const char *key) {
     j65_node *n;
+    j65_key_index *index;
+    size_t i;
+
+    if (object->node_type == J65_START_OBJ && object->index != NULL) {
+        index = object->index;
+        i = hash_key (key, index->mask);
+        while ((n = index->slots[i]) != NULL) {
+            if (n->string == key)
+                return n;
+            i = (i + 1) & index->mask;
+        }
+        return NULL;
+    }
+
     if (object->node_type == J65_START_OBJ)
         n = object->child;
     else if (object->node_type == J65_KEY)
@@ -155,36 +458,72 @@ j65_node * __fastcall__ j65_find_interned_key (j65_node *object,
     return NULL;
 }
 
+size_t __fastcall__ j65_array_length (const j65_node *array) {
+    if (array->node_type == J65_START_ARRAY ||
+        array->node_type == J65_START_OBJ)
+        return array->count;
+    return 0;
+}
+
+j65_node * __fastcall__ j65_array_get (const j65_node *array, size_t i) {
+    j65_node *n;
+
+    if (array->node_type != J65_START_ARRAY || i >= array->count)
+        return NULL;
+
+    if (array->elements != NULL)
+        return array->elements[i];
+
+    /* (the records in record-at-a-time mode are counted, but gone) */
+    for (n = array->child; n != NULL && i > 0; i--)
+        n = n->next;
+
+    return n;
+}
+
+int8_t __fastcall__ j65_index_array (j65_tree *t, j65_node *array) {
+    j65_tree_internal *tree = (j65_tree_internal *) t;
+    j65_node **elements;
+    j65_node *n;
+    size_t bytes = array->count * sizeof (j65_node *);
+    size_t i = 0;
+
+    if (array->node_type != J65_START_ARRAY || array->elements != NULL ||
+        still_open (tree, array))
+        return 0;
+
+    /* the records in record-at-a-time mode are counted, but gone, so
+       there is nothing to index unless every element is there */
+    for (n = array->child; n != NULL; n = n->next)
+        i++;
+    if (i != array->count || i == 0)
+        return 0;
+
+    elements = (j65_node **) tree_alloc (tree, bytes);
+    if (elements == NULL)
+        return J65_OUT_OF_MEMORY;
+
+    i = 0;
+    for (n = array->child; n != NULL; n = n->next)
+        elements[i++] = n;
+
+    array->elements = elements;
+    return 0;
+}
+
 void __fastcall__ j65_free_tree (j65_tree *t) {
     j65_tree_internal *tree = (j65_tree_internal *) t;
-    j65_node *n = tree->root;
-    j65_node *follow;
 
-    /* traverse the entire tree without recursion */
-    /* (since 6502 stack is limited) */
-    while (n != NULL) {
-        switch (n->node_type) {
-        case J65_KEY:
-        case J65_START_OBJ:
-        case J65_START_ARRAY:
-            follow = n->child;
-            n->child = NULL;
-            if (follow != NULL)
-                break;
-            /* fall thru */
-        default:
-            /* node has no children (either a leaf or empty container) */
-            follow = n->next;
-            if (follow == NULL) /* no remaining siblings, either */
-                follow = n->parent;
-            free (n);
-        }
-        n = follow;
-    }
+    /* nodes in an arena are all freed at once */
+    if (tree->arena != NULL)
+        j65_reset_arena (tree->arena);
+    else
+        free_nodes (tree->root, tree->record_cb != NULL);
 
     tree->root = NULL;
     tree->current = NULL;
     tree->add_child = true;
+    tree->depth = 0;
 
     j65_free_strings (&tree->strings);
 }
@@ -30,7 +30,7 @@
 
 /* in addition to the status codes from j65_status */
 enum {
-    J65_OUT_OF_MEMORY = -1,     /* malloc returned NULL */
+    J65_OUT_OF_MEMORY = -1,     /* malloc returned NULL, or arena full */
 };
 
 /*
@@ -56,6 +56,7 @@ typedef struct {
 } j65_source_location;
 
 typedef struct j65_node j65_node;
+typedef struct j65_key_index j65_key_index;
 
 /*
   j65_node represents a value parsed from the JSON file.
@@ -82,19 +83,86 @@ typedef struct j65_node j65_node;
   Container nodes point to their first child.  Each child
   node points to its next sibling via the next pointer.
   The final sibling has a NULL next pointer.
+
+  Container nodes also have a count of their children.
+
+  J65_START_OBJ nodes don't have a string, so they use that space
+  for a pointer to a hashed index of their keys, which is built the
+  first time j65_find_key() is used on a large object.  Likewise,
+  J65_START_ARRAY nodes use it for a pointer to a vector of their
+  elements, which is built by j65_index_array().  (Otherwise, these
+  pointers are NULL.)
+
+  The location comes last, because it is optional (see
+  j65_set_tree_locations).  Nodes without a location, or with only
+  an offset, are allocated with less memory than sizeof (j65_node),
+  so the fields which are left out must not be used.
  */
 struct j65_node {
     uint8_t node_type;
-    j65_source_location location;
     j65_node *parent;
     j65_node *next;
     union {
         int32_t integer;        /* J65_INTEGER */
         struct {
-            const char *string; /* J65_KEY, J65_NUMBER, or J65_STRING */
+            union {
+                const char *string;   /* J65_KEY, J65_NUMBER, or J65_STRING */
+                j65_key_index *index; /* J65_START_OBJ */
+                j65_node **elements;  /* J65_START_ARRAY */
+            };
             j65_node *child;    /* J65_KEY, J65_START_OBJ, or J65_START_ARRAY */
+            size_t count;       /* J65_KEY, J65_START_OBJ, or J65_START_ARRAY */
         };
     };
+    union {
+        j65_source_location location; /* J65_LOCATIONS_FULL */
+        uint32_t offset;              /* J65_LOCATIONS_OFFSET */
+    };
+};
+
+/*
+  How much of the location to keep in each node.  (See
+  j65_set_tree_locations.)  On the 6502, a node takes 23 bytes with
+  J65_LOCATIONS_FULL, 15 bytes with J65_LOCATIONS_OFFSET, and 11 bytes
+  with J65_LOCATIONS_NONE.
+
+  J65_LOCATIONS_OFFSET keeps only the byte offset of the position in
+  the file.  j65_find_location() can turn it back into a line and
+  column, if the text of the file is still available.
+ */
+enum j65_locations {
+    J65_LOCATIONS_FULL   = 0,
+    J65_LOCATIONS_OFFSET = 1,
+    J65_LOCATIONS_NONE   = 2,
+};
+
+/*
+  An arena is memory supplied by the caller, from which the nodes of
+  a tree can be allocated, instead of calling malloc() for each one.
+  Nodes are allocated one after another from mem, so allocating them
+  is fast, and there is no fragmentation.  Freeing the tree just
+  resets the arena, so all of its memory is available again.
+
+  If one block of memory is not enough, several arenas can be chained
+  together with the next pointer.  When one is full, nodes are
+  allocated from the next one.  (The arenas are used in order, and
+  once a node comes from an arena, the ones before it aren't used
+  again until the tree is freed.)  Each node takes sizeof (j65_node)
+  bytes, so an arena of n * sizeof (j65_node) bytes holds n nodes.
+  (Fewer bytes, if locations are left out of the nodes.  See
+  j65_node_size.)
+
+  Initialize each arena with j65_init_arena(), and then set next if
+  you wish to chain them.  Only the nodes come from the arena; the
+  strings in the intern pool are still allocated with malloc().
+ */
+typedef struct j65_arena j65_arena;
+
+struct j65_arena {
+    uint8_t *mem;
+    size_t size;
+    size_t used;
+    j65_arena *next;
 };
 
 /*
@@ -117,14 +185,106 @@ struct j65_node {
 typedef struct {
     j65_strings strings;
     j65_node *root;
-    uint8_t internal[3];
+    uint8_t internal[14];
 } j65_tree;
 
 /*
-  Initializes the j65_tree structure for use.
+  The type of the callback function passed to j65_set_tree_records.
+  It is called with each record once the record is complete.  The
+  record is the root of a complete subtree, which may be used (and
+  searched with j65_find_key, and so on) until the callback returns,
+  after which it is freed.  If record is a J65_KEY node, the value
+  is its child.
+
+  The callback should return zero to carry on parsing, or a negative
+  error code, which will be returned by j65_parse(), to stop.
+ */
+typedef int8_t __fastcall__ (*j65_record_callback) (j65_tree *t,
+                                                    j65_node *record);
+
+/*
+  Initializes the j65_tree structure for use.  Nodes will be
+  allocated with malloc().
  */
 void __fastcall__ j65_init_tree (j65_tree *t);
 
+/*
+  Initializes the j65_tree structure for use, like j65_init_tree(),
+  except that nodes will be allocated from the given arena (or from
+  the arenas chained to it).  If they are all full,
+  j65_tree_callback() returns J65_OUT_OF_MEMORY.  The arena must not
+  be used for another tree until this tree has been freed.
+ */
+void __fastcall__ j65_init_tree_arena (j65_tree *t, j65_arena *arena);
+
+/*
+  Chooses how much of the location to keep in each node (see the
+  j65_locations enumeration).  j65_init_tree() and
+  j65_init_tree_arena() choose J65_LOCATIONS_FULL, so if you want
+  smaller nodes, call j65_set_tree_locations() after one of them, and
+  before the first call to j65_parse().
+ */
+void __fastcall__ j65_set_tree_locations (j65_tree *t, uint8_t locations);
+
+/*
+  Turns on record-at-a-time mode, for files which are too big to fit
+  in memory as a whole tree, but which are made up of records which
+  do fit, such as a huge top-level array.  Each value nested depth
+  levels deep (a depth of 0 is treated as 1) is a record.  (So, with a
+  depth of 1, each element of a top-level array is a record, as is
+  each key and its value in a top-level object.)  With a depth of 2,
+  the records could be the elements of an array in a top-level
+  object, such as {"items": [...]}.  As soon as a record is complete,
+  it is passed to cb, and then freed, before the next record starts.
+  So only one record (plus the arrays and objects enclosing the
+  records) is in memory at a time.
+
+  In this mode, strings and numbers are not interned, so that they
+  can be freed with their records.  (Keys are still interned, so
+  that j65_find_key works, so each distinct key stays in memory.)
+  With an arena, each record's nodes and strings are released by
+  moving the arena back to where the record started.
+
+  After parsing, the tree contains only the enclosing arrays and
+  objects (and anything else which was not part of a record), and
+  j65_array_length() of an enclosing array gives the number of
+  records which were in it.
+
+  Call j65_set_tree_records() after j65_init_tree() (or
+  j65_init_tree_arena), and before the first call to j65_parse().
+ */
+void __fastcall__ j65_set_tree_records (j65_tree *t, uint8_t depth,
+                                        j65_record_callback cb);
+
+/*
+  Returns the number of bytes taken by each node, with the given
+  j65_locations value.  This is useful for sizing an arena.
+ */
+size_t __fastcall__ j65_node_size (uint8_t locations);
+
+/*
+  Works out the line number, column number, and line offset of the
+  byte at the given offset in the file (such as the offset in a node
+  with J65_LOCATIONS_OFFSET), by counting the line endings before it,
+  the same way the parser does.  buf must contain the file from its
+  beginning up to (at least) offset.
+ */
+void __fastcall__ j65_find_location (const char *buf, uint32_t offset,
+                                     j65_source_location *loc);
+
+/*
+  Initializes an arena which allocates from the size bytes at mem.
+  The next pointer is set to NULL.
+ */
+void __fastcall__ j65_init_arena (j65_arena *a, void *mem, size_t size);
+
+/*
+  Makes all of the memory in the arena (and any arenas chained to
+  it) available again.  j65_free_tree() calls this for a tree which
+  was initialized with j65_init_tree_arena().
+ */
+void __fastcall__ j65_reset_arena (j65_arena *a);
+
 /*
   This should be specified as the callback to j65_parse(),
   and the j65_tree structure should be specified as the
@@ -139,6 +299,16 @@ int8_t __fastcall__ j65_tree_callback (j65_parser *p, uint8_t event);
   J65_START_OBJ node whose key matches the given string.
   The matching J65_KEY node is returned, or NULL if there is
   no match.
+
+  Finding a key in a large object means walking through all of
+  its keys, so the first time a search in an object passes 16
+  keys, j65_find_key() builds a hash table of that object's keys,
+  and later searches use it instead.  The table is allocated the
+  same way as the nodes (from the arena, or with malloc()), and it
+  is freed by j65_free_tree().  If there is no memory for it, keys
+  are still found, just more slowly.  (An object which is still being
+  parsed, such as one enclosing the records in record-at-a-time mode,
+  is not indexed, since more keys may be added to it.)
  */
 j65_node * __fastcall__ j65_find_key (j65_tree *t,
                                       j65_node *object,
@@ -150,16 +320,48 @@ j65_node * __fastcall__ j65_find_key (j65_tree *t,
   tree's string intern pool.  The node passed in should be
   of type J65_START_OBJ, and its J65_KEY children are
   searched.  The matching J65_KEY node is returned, or NULL if
-  there is no match.
+  there is no match.  If j65_find_key() has already built a key
+  index for the object, it is used.
  */
 j65_node * __fastcall__ j65_find_interned_key (j65_node *object,
                                                const char *key);
 
+/*
+  Returns the number of elements in the given J65_START_ARRAY node
+  (or the number of keys in a J65_START_OBJ node).  This is counted
+  as the tree is built, so it doesn't have to walk the array.  For
+  any other type of node, returns 0.
+ */
+size_t __fastcall__ j65_array_length (const j65_node *array);
+
+/*
+  Returns element i (counting from 0) of the given J65_START_ARRAY
+  node, or NULL if i is past the end of the array, or if array is not
+  a J65_START_ARRAY node.  This walks the array from the beginning,
+  unless j65_index_array() has been called on it, in which case it
+  takes the same (short) time for any element.
+ */
+j65_node * __fastcall__ j65_array_get (const j65_node *array, size_t i);
+
+/*
+  Builds a vector of pointers to the elements of the given
+  J65_START_ARRAY node, so that j65_array_get() doesn't have to walk
+  the array.  The vector is allocated the same way as the nodes (from
+  the arena, or with malloc()), and it is freed by j65_free_tree().
+  Returns 0 on success (or if the array already has a vector), or
+  J65_OUT_OF_MEMORY.  (j65_array_get() still works in that case.)
+  An array which is still being parsed, or whose elements are not all
+  in the tree, such as one enclosing the records in record-at-a-time
+  mode, is left without a vector, and 0 is returned.
+ */
+int8_t __fastcall__ j65_index_array (j65_tree *t, j65_node *array);
+
 /*
   Frees all the memory used by this tree.  The tree is traversed,
-  and all of the nodes are freed.  Additionally, j65_free_strings()
-  is called on the string intern pool contained within the
-  j65_tree structure.
+  and all of the nodes are freed.  (Or, if the tree was initialized
+  with j65_init_tree_arena(), the arena is simply reset, without
+  traversing the tree.)  Additionally, j65_free_strings() is called
+  on the string intern pool contained within the j65_tree structure.
  */
 void __fastcall__ j65_free_tree (j65_tree *t);
 
@@ -46,6 +46,16 @@ enum j65_event {
     J65_END_OBJ     = 8,
     J65_START_ARRAY = 9,
     J65_END_ARRAY   = 10,
+    J65_STRING_PART = 11,       /* string (see J65_STREAM_STRINGS) */
+    J65_KEY_PART    = 12,       /* string (see J65_STREAM_STRINGS) */
+};
+
+/*
+  The number of different j65_event values.  (The size of the table
+  passed to j65_init_handlers().)
+ */
+enum {
+    J65_NUM_EVENTS = 13
 };
 
 /*
@@ -53,7 +63,10 @@ enum j65_event {
   complete JSON value has been parsed successfully.  J65_WANT_MORE
   indicates that j65_parse() should be called again with more input.
   (If the end of the file has been reached, this can be considered an
-  "unexpected end of file" error.)
+  "unexpected end of file" error.)  J65_RING_FULL is only returned by
+  a parser initialized with j65_init_ring(), and indicates that the
+  ring needs to be drained.  (See j65_init_ring().)  J65_YIELD
+  indicates that the callback returned J65_YIELD.  (See j65_callback.)
 
   Negative values indicate errors.  The error may be one of the
   predefined errors below, or it may be an error returned by the
@@ -76,6 +89,9 @@ enum j65_event {
 enum j65_status {
     J65_DONE      = 1,
     J65_WANT_MORE = 2,
+    J65_SKIP      = 3,          /* only returned by the callback */
+    J65_RING_FULL = 4,
+    J65_YIELD     = 5,
 
     /* errors */
     J65_PARSE_ERROR        = -128,
@@ -88,18 +104,93 @@ enum j65_status {
     J65_EXPECTED_COMMA,
     J65_EXPECTED_OBJ_END,
     J65_EXPECTED_ARRAY_END,
+    J65_ILLEGAL_UTF8,           /* only with J65_CHECK_UTF8 */
     J65_USER_ERROR,             /* must be last.  not generated by parser. */
 };
 
+/*
+  Options which may be turned on by calling j65_set_options().  These
+  are bit flags, so they may be combined with "|".
+
+  J65_STREAM_STRINGS lifts the 255-byte limit on the length of strings
+  and keys.  Whenever the parser's string buffer fills up, the part of
+  the string collected so far is delivered in a J65_STRING_PART or
+  J65_KEY_PART event, and the buffer is emptied.  The final piece is
+  delivered in the usual J65_STRING or J65_KEY event, so the complete
+  string is the concatenation of any J65_STRING_PART events (or
+  J65_KEY_PART events), followed by the J65_STRING (or J65_KEY) event.
+  Backslash escapes are never split between two events, but a
+  multibyte UTF-8 character may be.  Numbers are not affected by this
+  option, and are still limited to 255 bytes (or to the limit set by
+  j65_set_max_length).
+
+  J65_BORROW_STRINGS avoids copying strings and keys into the parser's
+  string buffer, when possible.  A string which has no backslash
+  escapes, and which lies entirely within one 256-byte page of the buf
+  passed to j65_parse() (counting from the start of buf), is left
+  where it is, and j65_get_view() returns a pointer to it in buf.
+  Otherwise, the string is copied as usual.  j65_get_string() still
+  works either way, but it copies a borrowed string into the string
+  buffer (in order to NUL-terminate it), so use j65_get_view()
+  instead to get the benefit.  This option has no effect in ring
+  mode (see j65_init_ring), since the ring gets a copy of the string
+  anyway.
+
+  J65_RECOVER is for parsing a stream of records, such as
+  newline-delimited JSON (see j65_reset).  An error is still returned
+  by j65_parse() as usual, and j65_get_consumed() gives the offset of
+  the byte where it occurred.  But the parser is not left unusable:
+  if the rest of buf (starting at that offset) is passed to the next
+  call to j65_parse(), the rest of the bad record is skipped, and
+  parsing carries on with the next record.  The bad record is
+  considered to end at the next newline (each record in
+  newline-delimited JSON is one line), or at the close bracket or
+  brace which ends the top-level value, whichever comes first.  Call
+  j65_reset() after J65_DONE as usual, but not after an error.
+
+  J65_CHECK_UTF8 makes the parser check that the bytes of each string
+  and key (other than those produced by \u escapes, which are always
+  valid) are well-formed UTF-8.  Overlong encodings, surrogates, code
+  points above U+10FFFF, and characters which are cut short are all
+  rejected with J65_ILLEGAL_UTF8, and j65_get_consumed() gives the
+  offset of the first byte which doesn't fit.  A character may be
+  split between two chunks of input.  ASCII characters are not slowed
+  down, but each non-ASCII byte costs roughly as much again as it
+  would without the check.
+ */
+enum j65_option {
+    J65_STREAM_STRINGS = 0x01,
+    J65_BORROW_STRINGS = 0x02,
+    J65_RECOVER        = 0x04,
+    J65_CHECK_UTF8     = 0x08,
+};
+
 /*
   The state for a JSON parser.  Initialize it by calling j65_init().
   It is too big to be allocated on the cc65 stack, so you should either
   allocate it statically, or on the heap.
+
+  If 512 bytes is too much, a smaller block can be used instead, with
+  a shorter string buffer and a lower maximum depth.  It must be at
+  least J65_PARSER_SIZE(max_depth, max_len) bytes, where max_depth is
+  the value passed to j65_init() (or one of the other initializers),
+  and max_len is the value passed to j65_set_max_length().  Cast its
+  address to a j65_parser pointer.  For example:
+
+    static uint8_t small[J65_PARSER_SIZE(8, 32)];
+    j65_parser *p = (j65_parser *) small;
+
+    j65_init (p, ctx, callback, 8);
+    j65_set_max_length (p, 32);
  */
 typedef struct {
     uint8_t dummy[512];
 } j65_parser;
 
+#define J65_PARSER_SIZE(max_depth, max_len)                     \
+    (36 + ((max_depth) ? (max_depth) : 255) / 8 + 1 +           \
+     ((max_len) < 8 ? 8 : (max_len)) + 1)
+
 /*
   The type of the callback function passed to j65_init.  This is called
   from within j65_parse() whenever a parsing "event" occurs.  The event
@@ -113,9 +204,62 @@ typedef struct {
   cause j65_parse() to return immediately, the callback should return
   a negative value.  (Specifically, it should return an integer between
   J65_USER_ERROR and -1, inclusive.)
+
+  For a J65_START_OBJ, J65_START_ARRAY, or J65_KEY event, the callback
+  may also return J65_SKIP, if it is not interested in the object or
+  array which was just started, or in the value of the key.  The
+  callback will then not be called again until the parser gets to the
+  end of that object, array, or value.  (The J65_END_OBJ or
+  J65_END_ARRAY event for a skipped object or array is not delivered,
+  either.)  The skipped JSON is still checked for errors, so
+  j65_parse() returns the same status as it would have otherwise.
+  Returning J65_SKIP for any other event is the same as returning zero.
+
+  For any event, the callback may return J65_YIELD, to make j65_parse()
+  return J65_YIELD right away, so that the caller can do something else
+  for a while.  (Unless that was the last event, in which case
+  j65_parse() returns J65_DONE as usual.)  To carry on where it left
+  off, call j65_parse() again with the rest of buf, starting at the
+  offset given by j65_get_consumed().
  */
 typedef int8_t __fastcall__ (*j65_callback)(j65_parser *p, uint8_t event);
 
+/*
+  A ring buffer of event records, for use with j65_init_ring().  buf
+  points to size bytes of storage, which must be at least 262.  The
+  parser appends records at head, and the caller removes them from
+  tail.  When head and tail are equal, the ring is empty.  Set both
+  to 0 before the first call to j65_parse().
+
+  Each record consists of:
+
+    - the event type (a j65_event, as a uint8_t)
+    - the length of the string (a uint8_t), or 0 if the event has none
+    - for J65_INTEGER only, the integer (an int32_t, little-endian)
+    - the string, if the event has one (see j65_get_string())
+    - a NUL byte
+
+  so a record for a J65_INTEGER event is 7 bytes plus the length of
+  the string, and any other record is 3 bytes plus the length of the
+  string.  A record is never split across the end of buf.  Instead, a
+  J65_RING_WRAP byte is stored where the next record would have gone,
+  and the record is stored at the start of buf.  So, when reading a
+  record, if tail is equal to size, or the byte at tail is
+  J65_RING_WRAP, continue reading from the start of buf.
+
+  When the ring is empty, the parser may move head and tail back to 0.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head;
+    size_t tail;
+} j65_ring;
+
+enum {
+    J65_RING_WRAP = 0xff
+};
+
 /*
   Initializes a j65_parser structure.  The arguments passed will be
   stored in the j65_parser structure.  Specifically:
@@ -127,17 +271,18 @@ typedef int8_t __fastcall__ (*j65_callback)(j65_parser *p, uint8_t event);
   event occurs.
 
   max_depth is the maximum depth of nested objects and arrays allowed
-  when parsing the JSON.  max_depth will automatically be capped at
-  224.  It may sometimes be helpful to limit max_depth to a
-  smaller value.  (For example, if you are going to build up a tree
-  and then walk it recursively, the 6502 stack cannot hold 224
-  return addresses, so you could limit max_depth to a value somewhat
-  less than 128, to prevent overflowing the stack.)  To obtain the
+  when parsing the JSON.  (The parser only needs one bit of memory
+  for each level, so it can allow up to 255.)  It may sometimes be
+  helpful to limit max_depth to a smaller value.  (For example, if you
+  are going to build up a tree and then walk it recursively, the 6502
+  stack cannot hold 255 return addresses, so you could limit max_depth
+  to a value somewhat less than 128, to prevent overflowing the
+  stack.)  To obtain the
   value actually used for max_depth, call j65_get_max_depth() on the
   parser.
 
   If max_depth is 0, then it will be set to the maximum allowable
-  value, which is 224.  So, if you do not wish to furhter limit the
+  value, which is 255.  So, if you do not wish to furhter limit the
   maximum depth, pass 0 for max_depth.  This means that the smallest
   value you can actually set max_depth to is 1, which means that you
   can only have a top-level array or object, but no arrays or objects
@@ -153,6 +298,132 @@ void __fastcall__ j65_init (j65_parser *p,
                             j65_callback cb,
                             uint8_t max_depth);
 
+/*
+  An alternative to j65_init(), for when you are only interested in
+  a few kinds of events.  Instead of a single callback, handlers is
+  a table of J65_NUM_EVENTS callbacks, indexed by the j65_event
+  enumeration.  When an event occurs, the entry for that event is
+  called, with the same arguments and return values as the callback
+  passed to j65_init().  If the entry is NULL, nothing is called, and
+  the parser carries on as though the callback had returned zero.
+  This is considerably faster than calling a callback which ignores
+  the event.
+
+  The table is not copied, so it must remain valid for as long as
+  the parser is in use.  The other arguments are the same as for
+  j65_init().
+ */
+void __fastcall__ j65_init_handlers (j65_parser *p,
+                                     void *ctx,
+                                     const j65_callback *handlers,
+                                     uint8_t max_depth);
+
+/*
+  An alternative to j65_init(), which calls no callback at all.
+  Instead, j65_parse() appends a record for each event to ring.  (See
+  j65_ring above.)  This way, many events can be handled in one loop
+  over the ring, after j65_parse() returns, which is much cheaper than
+  calling a function for every event.
+
+  If there is no room in the ring for the next record, j65_parse()
+  returns J65_RING_FULL.  The caller should then remove some (or all)
+  of the records from the ring, and call j65_parse() again with the
+  rest of the input.  Call j65_get_consumed() to find out how much of
+  the input was used, like this:
+
+    ret = j65_parse (&parser, buf, len);
+    while (ret == J65_RING_FULL) {
+        consumed = j65_get_consumed (&parser);
+        buf += consumed;
+        len -= consumed;
+        (remove records from the ring)
+        ret = j65_parse (&parser, buf, len);
+    }
+    (remove records from the ring)
+
+  Be sure to remove records from the ring after j65_parse() returns
+  J65_DONE, J65_WANT_MORE, or an error, too.  j65_get_string() and
+  the other accessors which describe the current event are of no use
+  in this mode, since the event data is in the ring.
+
+  The ring is not copied, so it must remain valid for as long as the
+  parser is in use.  The other arguments are the same as for
+  j65_init().
+ */
+void __fastcall__ j65_init_ring (j65_parser *p,
+                                 void *ctx,
+                                 j65_ring *ring,
+                                 uint8_t max_depth);
+
+/*
+  An alternative to j65_init(), for when you only want to know whether
+  the input is valid JSON.  No callback is called, strings are not
+  copied into the parser, and integers are not converted, so
+  j65_parse() is a good deal faster than with a callback which ignores
+  every event.  (About twice as fast, depending on the input.)
+
+  j65_parse() returns the same status it would return when parsing,
+  and on error, j65_get_line_number(), j65_get_column_number(), and
+  j65_get_consumed() tell where the error was, as usual.  The one
+  difference is that strings are not limited to 255 bytes, since they
+  are not kept.  (Numbers still are.)  j65_get_string() and the other
+  accessors which describe the current event are of no use in this
+  mode.
+
+  max_depth is the same as for j65_init().  J65_RECOVER and
+  J65_CHECK_UTF8 may be turned on with j65_set_options(); the other
+  options make no difference.
+ */
+void __fastcall__ j65_init_validate (j65_parser *p, uint8_t max_depth);
+
+/*
+  Turns on the given options (see the j65_option enumeration), and
+  turns off all others.  j65_init() turns all options off, so if you
+  want any options, call j65_set_options() after j65_init() (or
+  j65_init_handlers()) and before the first call to j65_parse().
+ */
+void __fastcall__ j65_set_options (j65_parser *p, uint8_t options);
+
+/*
+  Limits strings (and keys, and numbers) to max_len bytes, instead of
+  255, and moves the string buffer down to just after the state
+  variables, so that the parser fits in J65_PARSER_SIZE(max_depth,
+  max_len) bytes.  (See j65_parser.)  Longer strings are
+  J65_STRING_TOO_LONG, unless J65_STREAM_STRINGS is on, in which case
+  they are delivered in pieces of at most max_len bytes.  Borrowed
+  strings (see J65_BORROW_STRINGS) are limited to max_len bytes, too.
+  max_len is rounded up to 8 if it is smaller than that.
+
+  Since j65_init() (and the other initializers) set the limit back to
+  255, call j65_set_max_length() after it, and before the first call
+  to j65_parse().  j65_reset() leaves the limit alone.
+ */
+void __fastcall__ j65_set_max_length (j65_parser *p, uint8_t max_len);
+
+/*
+  Gets a parser ready to parse another JSON value, without changing
+  the callback (or handlers or ring), context, options, or maximum
+  depth.  This is cheaper than calling j65_init() again, and is meant
+  for parsing a stream of JSON values, such as newline-delimited JSON.
+
+  If keep_position is nonzero, the file offset and line number keep
+  counting from where the last value left off, so that they describe
+  the position in the whole stream.  Otherwise, they start over at 0.
+
+  For example, to parse every value in buf:
+
+    while (len > 0) {
+        ret = j65_parse (&parser, buf, len);
+        if (ret != J65_DONE)
+            break;
+        consumed = j65_get_consumed (&parser);
+        buf += consumed;
+        len -= consumed;
+        j65_reset (&parser, 1);
+    }
+ */
+void __fastcall__ j65_reset (j65_parser *p, uint8_t keep_position);
+
 /*
   Parses the JSON in buf, of length len.  j65_parse() may be called
   multiple times (as long as it returns J65_WANT_MORE) to parse input
@@ -164,24 +435,43 @@ void __fastcall__ j65_init (j65_parser *p,
   The return value is the j65_status enumeration, returned as an
   int8_t.  J65_DONE indicates the parsing completed successfully.
   J65_WANT_MORE indicates that j65_parse() should be called again
-  with more input.  Any negative value indicates an error, either
-  one generated by the parser, or one returned by the callback.
+  with more input.  J65_RING_FULL indicates that j65_parse() should
+  be called again with the rest of the input, once the ring has been
+  drained.  Any negative value indicates an error, either one
+  generated by the parser, or one returned by the callback.
  */
 int8_t __fastcall__ j65_parse (j65_parser *p, const char *buf, size_t len);
 
+/*
+  Returns the number of bytes of buf which were used by the last call
+  to j65_parse().  This call is only valid after j65_parse() returns.
+
+  If j65_parse() returned J65_WANT_MORE, this is all of buf.  If it
+  returned J65_DONE, this is the number of bytes up to the end of the
+  JSON value (which may include one byte of whitespace after it).  If
+  it returned an error, this is the offset of the byte where the error
+  occurred.  If it returned J65_RING_FULL or J65_YIELD, the rest of
+  buf, starting at this offset, should be passed to the next call to
+  j65_parse().
+  After J65_DONE, the rest of buf may hold the next JSON value in a
+  stream.  (See j65_reset.)
+ */
+size_t __fastcall__ j65_get_consumed (const j65_parser *p);
+
 /*
   Returns the string associated with the current event.  This call is
   only valid inside the callback function, and only when the event is
-  one of J65_INTEGER, J65_NUMBER, J65_STRING, or J65_KEY.
+  one of J65_INTEGER, J65_NUMBER, J65_STRING, J65_KEY, J65_STRING_PART,
+  or J65_KEY_PART.
   The string returned is only valid until the callback returns.
 
   The string is NUL-terminated, so it is not necessary to call
   j65_get_length(), unless you wish to support strings with
   embedded NUL characters.
 
-  In the case of a J65_NUMBER OR J65_KEY event, backslash escape
-  sequences in the string have already been substituted.  The string
-  is UTF-8 encoded.
+  In the case of a J65_STRING, J65_KEY, J65_STRING_PART, or
+  J65_KEY_PART event, backslash escape sequences in the string have
+  already been substituted.  The string is UTF-8 encoded.
 
   In the case of a J65_NUMBER event, beware that although the number
   has been validated to contain only characters that are legal in a
@@ -204,6 +494,25 @@ const char * __fastcall__ j65_get_string (const j65_parser *p);
  */
 uint8_t __fastcall__ j65_get_length (const j65_parser *p);
 
+/*
+  Like j65_get_string(), but the string is not necessarily
+  NUL-terminated, so you need to call j65_get_length() to get its
+  length.  If the J65_BORROW_STRINGS option is on, the string might
+  be "borrowed," meaning that it points into the buf which was passed
+  to j65_parse().  (Otherwise, it points into the parser's string
+  buffer, just like j65_get_string().)  Either way, the string is
+  only valid until the callback returns.
+ */
+const char * __fastcall__ j65_get_view (const j65_parser *p);
+
+/*
+  Returns 1 if the string returned by j65_get_view() is borrowed (see
+  J65_BORROW_STRINGS), or 0 if it is in the parser's string buffer.
+  This call is only valid inside the callback function, and only when
+  the event is J65_STRING or J65_KEY.
+ */
+uint8_t __fastcall__ j65_is_borrowed (const j65_parser *p);
+
 /*
   Returns the integer associated with the current event.  This call is
   only valid inside the callback function, and only when the event is
@@ -214,6 +523,11 @@ uint8_t __fastcall__ j65_get_length (const j65_parser *p);
   If a number cannot be represented as an int32_t, either because it
   is non-integral, or because it is too large, then a J65_NUMBER
   event is generated instead of J65_INTEGER.
+
+  If json65.s is assembled with J65_INT16 defined, only integers which
+  fit in an int16_t are J65_INTEGER.  (They are still returned as an
+  int32_t.)  If it is assembled with J65_NO_INTEGER_CONVERSION
+  defined, every number is a J65_NUMBER.
  */
 int32_t __fastcall__ j65_get_integer (const j65_parser *p);
 
@@ -244,6 +558,11 @@ uint32_t __fastcall__ j65_get_line_offset (const j65_parser *p);
   return is not counted if it is immediately preceded by a linefeed.
   (Thus allowing MS-DOS/Windows standard line endings to be supported
   as well.)
+
+  If json65.s is assembled with J65_NO_POSITIONS defined, lines are
+  not counted, so j65_get_line_number() and j65_get_line_offset()
+  always return 0, and j65_get_column_number() returns the offset
+  within the file.
 */
 uint32_t __fastcall__ j65_get_line_number (const j65_parser *p);
 
@@ -269,15 +588,15 @@ uint32_t __fastcall__ j65_get_column_number (const j65_parser *p);
 /*
   Returns the current depth of nested arrays and objects.
   It can be between 0 and max_depth (which is never more than
-  224), inclusive.  Depth 0 only occurs for top-level scalars.
+  255), inclusive.  Depth 0 only occurs for top-level scalars.
  */
 uint8_t __fastcall__ j65_get_current_depth (const j65_parser *p);
 
 /*
   Returns the maximum value that j65_get_current_depth() can have.
   This is the value of max_depth which was supplied to j65_init(),
-  unless the value supplied was 0 or was greater than 224, in which
-  case the max depth will be 224.
+  unless the value supplied was 0, in which case the max depth will
+  be 255.
 
   If this depth is exceeded, the parser will return the error code
   J65_NESTING_TOO_DEEP.
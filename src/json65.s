@@ -22,19 +22,48 @@
 
         .macpack generic
         .include "zeropage.inc"
+        .include "json65-macros.inc"
 
 ;; routines from the cc65 runtime library
         .import callptr4
+        .import incsp2
         .import incsp4
         .import incsp6
-        .import negeax
+        .import push0
         .import pushax
+
+;; build options.  define any of these (with ca65 -D, or cl65
+;; --asm-define) to leave out code which not every program needs:
+;;   J65_NO_POSITIONS           don't count lines.  j65_get_line_number
+;;                              and j65_get_line_offset are always 0,
+;;                              so j65_get_column_number is the offset
+;;                              from the start of the input.
+;;   J65_NO_UNICODE_ESCAPES     \u escapes are J65_ILLEGAL_ESCAPE.
+;;   J65_INT16                  integers are only converted if they fit
+;;                              in 16 bits.  others are J65_NUMBER.
+;;   J65_NO_INTEGER_CONVERSION  all numbers are J65_NUMBER.
+.if .defined(J65_NO_INTEGER_CONVERSION)
+        int_bits = 0
+.elseif .defined(J65_INT16)
+        int_bits = 16
+.else
+        int_bits = 32
+        .import negeax
         .import resteax
         .import saveeax
+.endif
 
         .export _j65_init
+        .export _j65_init_handlers
+        .export _j65_init_ring
+        .export _j65_init_validate
         .export _j65_parse
+        .export _j65_set_options
+        .export _j65_set_max_length
+        .export _j65_reset
         .export _j65_get_string
+        .export _j65_get_view
+        .export _j65_is_borrowed
         .export _j65_get_length
         .export _j65_get_integer
         .export _j65_get_line_offset
@@ -43,6 +72,7 @@
         .export _j65_get_current_depth
         .export _j65_get_max_depth
         .export _j65_get_context
+        .export _j65_get_consumed
 
 ;; zero page locations
         state     = regbank
@@ -58,6 +88,23 @@
         long2     = ptr1
 ;; zero page locations (for _j65_parse)
         jlen      = ptr3
+;; zero page locations (for parse)
+;; working copies of the most heavily used state variables.  these are
+;; loaded from the state on entry to parse, and written back on exit
+;; and around callbacks.  (must be in the same order as in st)
+        lexer_st  = ptr3
+        parser_st = ptr3+1
+        str_idx   = ptr4
+        flags     = ptr4+1
+        hot_state = lexer_st
+
+;; the jump tables hold each address minus 1, for rts to jump to,
+;; except on the 65C02, which has jmp (abs,x)
+.ifpc02
+        tab_adj   = 0
+.else
+        tab_adj   = 1
+.endif
 
 ;; character properties
         prop_ws   = %10000000   ; must be hi bit (we use bmi/bpl to test)
@@ -67,6 +114,12 @@
         prop_num  = %00001000
         prop_sc   = %00000111   ; mask for structural character field
 
+;; flags, while in a string.  (see start_hex, and check_utf8.)  bit 7
+;; means a left surrogate is waiting, and the low 3 bits count the
+;; digits left to read in a \u escape, or hold the UTF-8 state.
+        str_check_utf8 = %01000000 ; J65_CHECK_UTF8 is on
+        str_count      = %00000111
+
 ;; j65_event
 .enum
         J65_NULL        = 0
@@ -80,12 +133,31 @@
         J65_END_OBJ     = 8
         J65_START_ARRAY = 9
         J65_END_ARRAY   = 10
+        J65_STRING_PART = 11       ; string
+        J65_KEY_PART    = 12       ; string
 .endenum
 
+;; j65_option
+        J65_STREAM_STRINGS = $01
+        J65_BORROW_STRINGS = $02
+        J65_RECOVER        = $04
+        J65_CHECK_UTF8     = $08
+;; internal options, set by j65_init_handlers, j65_init_ring, and the
+;; parser itself (not by j65_set_options)
+        opt_handlers       = $80   ; callback is a table of handlers
+        opt_ring           = $40   ; callback is a j65_ring
+        opt_paused         = $20   ; ring is full; stop after this char
+        opt_yield          = $10   ; (with opt_paused) callback yielded
+        opt_validate       = opt_handlers | opt_ring ; (both) no callback
+        opt_internal       = opt_handlers | opt_ring | opt_paused | opt_yield
+
 ;; j65_status
 .enum
         J65_DONE      = 1
         J65_WANT_MORE = 2
+        J65_SKIP      = 3          ; only returned by callback
+        J65_RING_FULL = 4
+        J65_YIELD     = 5
 
         ; errors
         J65_PARSE_ERROR        = $80
@@ -98,6 +170,7 @@
         J65_EXPECTED_COMMA
         J65_EXPECTED_OBJ_END
         J65_EXPECTED_ARRAY_END
+        J65_ILLEGAL_UTF8
         J65_USER_ERROR             ; must be last.  not generated by parser.
 .endenum
 
@@ -105,8 +178,18 @@
 .enum
         lex_ready
         lex_literal
+.if int_bits > 0
+        lex_int                 ; a literal which is an integer so far
+.endif
+        lex_keyword             ; a literal which is null, true, or false
         lex_string
         lex_str_escape
+.ifndef J65_NO_UNICODE_ESCAPES
+        lex_str_hex             ; in the 4 hex digits of a \u escape
+        lex_str_surrogate       ; just after a \u left surrogate
+.endif
+        lex_str_borrow          ; a string still in inbuf, from str_idx
+        lex_recover             ; skipping the rest of a bad record
 .endenum
 
 ;; parser state (should fit in 3 bits; otherwise need to change l_ready)
@@ -141,18 +224,52 @@
         file_off   .dword
         line_off   .dword
         line_num   .dword
-        col_num    .dword
         long_val   .dword
-        lexer_st   .byte
-        parser_st  .byte
-        parser_st2 .byte
+        lexer_st   .byte        ; these four are the "hot state" and must
+        parser_st  .byte        ; be in the same order as in zero page
         str_idx    .byte
-        stack_idx  .byte
         flags      .byte
+        parser_st2 .byte
+        stack_idx  .byte
         stack_min  .byte
-        prev_char  .byte
+        cur_idx    .byte        ; charidx of the current event
+        options    .byte        ; j65_option flags
+        skip_idx   .byte        ; 1 + stack_idx of value being skipped
+        skip_on    .byte        ; nonzero while skipping
+        start_off  .word        ; low 16 bits of file_off at start of j65_parse
+        strbuf     .word        ; string buffer (usually state+256)
+        str_max    .byte        ; longest string strbuf can hold
+.endstruct
+
+;; the depth stack is packed, one bit per level, right after the state
+;; variables.  (see push_state_stack.)  stack_idx counts down from $ff,
+;; so the depth is limited to 255, which needs 32 bytes.  the string
+;; buffer comes after that, at state+256, unless j65_set_max_length
+;; moves it down to right after the bits for max_depth.
+        stack_bits = .sizeof(st)
+
+.assert stack_bits + 32 <= 256, error, "depth stack overlaps strbuf"
+.assert .sizeof(st) = 36, error, "J65_PARSER_SIZE in json65.h needs updating"
+
+;; nothing is skipped in ring mode, so skip_idx holds an event which
+;; did not fit in the ring (with the high bit set), or 0
+        pending = st::skip_idx
+
+;; j65_ring
+.struct ring
+        buf        .word
+        size       .word
+        head       .word
+        tail       .word
 .endstruct
 
+;; the longest record is for a J65_INTEGER event (which has the integer
+;; as well as its string) whose string fills strbuf, as leading zeros
+;; can do.  (json65.h says the ring must be at least this big.)
+        ring_max_record = 3 + 4 + 255
+
+        ring_wrap = $ff         ; J65_RING_WRAP
+
 ;; loads a with specified state variable.  clobbers y.
 .macro getstate arg
         ldy #arg
@@ -200,6 +317,35 @@
 
 ;; void __fastcall__ j65_init(j65_state *s, void *ctx, j65_callback cb, uint8_t max_depth);
 .proc _j65_init
+        ldx #0                  ; no options
+        jra init_parser
+.endproc                ; _j65_init
+
+;; void __fastcall__ j65_init_ring(j65_state *s, void *ctx, j65_ring *ring, uint8_t max_depth);
+.proc _j65_init_ring
+        ldx #opt_ring           ; ring instead of cb
+        jra init_parser
+.endproc                ; _j65_init_ring
+
+;; void __fastcall__ j65_init_validate(j65_state *s, uint8_t max_depth);
+.proc _j65_init_validate
+        pha                     ; save max_depth
+        jsr push0               ; no context
+        jsr push0               ; no callback
+        pla
+        ldx #opt_validate
+        jra init_parser
+.endproc                ; _j65_init_validate
+
+;; void __fastcall__ j65_init_handlers(j65_state *s, void *ctx, const j65_callback *handlers, uint8_t max_depth);
+.proc _j65_init_handlers
+        ldx #opt_handlers       ; fall thru with handler table instead of cb
+.endproc                ; _j65_init_handlers
+
+;; does the work for j65_init, j65_init_ring, j65_init_handlers, and
+;; j65_init_validate.
+;; arguments are the same, plus initial options in x.
+.proc init_parser
         sta tmp1                ; save max_depth
         lda state               ; save first 2 bytes of regbank
         sta ptr1
@@ -219,17 +365,26 @@ loop:   sta (state),y
         dey
         bpl loop
 
+        txa
+        putstate st::options
         lda #par_done
         putstate st::parser_st2
         lda #$ff
         putstate st::stack_idx
         lda #0
         sub tmp1                ; subtract max depth from 256
-        cmp #.sizeof(st)
-        bge depth_ok
-        lda #.sizeof(st)
+        bne depth_ok
+        lda #1                  ; 0 means the most allowed, 255
 depth_ok:
         putstate st::stack_min
+        lda #255                ; strbuf is state+256, until
+        putstate st::str_max    ; j65_set_max_length says otherwise
+        lda state
+        putstate st::strbuf
+        ldx state+1
+        inx
+        txa
+        putstate st::strbuf+1
 
         ldy #3                  ; copy callback and context from stack to state
 loop1:  lda (sp),y
@@ -242,7 +397,116 @@ loop1:  lda (sp),y
         lda ptr1+1
         sta state+1
         jmp incsp6              ; tail call to remove args from stack
-.endproc                ; _j65_init
+.endproc                ; init_parser
+
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;                          j65_set_options                         ;;
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+
+;; void __fastcall__ j65_set_options(j65_state *s, uint8_t options);
+.proc _j65_set_options
+        and #<~opt_internal     ; user can't change these
+        sta tmp1
+        ldy #0                  ; get state pointer off stack
+        lda (sp),y
+        sta ptr1
+        iny
+        lda (sp),y
+        sta ptr1+1
+        ldy #st::options
+        lda (ptr1),y
+        and #opt_internal
+        ora tmp1
+        sta (ptr1),y
+        jmp incsp2              ; tail call to remove arg from stack
+.endproc                ; _j65_set_options
+
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;                        j65_set_max_length                        ;;
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+
+;; void __fastcall__ j65_set_max_length(j65_state *s, uint8_t max_len);
+;; (moves strbuf down to right after the depth stack bits needed for
+;; max_depth, so the state only needs J65_PARSER_SIZE bytes.  max_len
+;; is at least 8, so the longest keyword, and any UTF-8 char, fit.)
+.proc _j65_set_max_length
+        cmp #8
+        bge len_ok
+        lda #8
+len_ok: sta tmp1
+        ldy #0                  ; get state pointer off stack
+        lda (sp),y
+        sta ptr1
+        iny
+        lda (sp),y
+        sta ptr1+1
+        ldy #st::str_max
+        lda tmp1
+        sta (ptr1),y
+        ldy #st::stack_min
+        lda #0
+        sub (ptr1),y            ; max_depth
+        lsr                     ; bytes of depth stack bits, minus 1
+        lsr
+        lsr
+        add #stack_bits + 1     ; strbuf = state + stack_bits + bytes
+        add ptr1
+        ldy #st::strbuf
+        sta (ptr1),y
+        lda ptr1+1
+        adc #0
+        iny
+        sta (ptr1),y
+        jmp incsp2              ; tail call to remove arg from stack
+.endproc                ; _j65_set_max_length
+
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;                             j65_reset                            ;;
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+
+;; void __fastcall__ j65_reset(j65_state *s, uint8_t keep_position);
+;; (only the state variables which change during a parse are reset.
+;; callback, context, options, and stack_min are left alone.)
+.proc _j65_reset
+        tax                     ; save keep_position
+        ldy #0                  ; get state pointer off stack
+        lda (sp),y
+        sta ptr1
+        iny
+        lda (sp),y
+        sta ptr1+1
+        lda #0                  ; lex_ready and par_ready
+        ldy #st::lexer_st
+        sta (ptr1),y
+        ldy #st::parser_st
+        sta (ptr1),y
+        ldy #st::str_idx
+        sta (ptr1),y
+        ldy #st::skip_idx       ; (also pending)
+        sta (ptr1),y
+        ldy #st::skip_on
+        sta (ptr1),y
+        txa
+        bne keep
+        ldy #st::flags          ; forget the last line ending
+        sta (ptr1),y
+        ldy #st::line_num+3     ; clear file_off, line_off, and line_num
+clear:  sta (ptr1),y
+        dey
+        cpy #st::file_off
+        bge clear
+keep:   lda #par_done
+        ldy #st::parser_st2
+        sta (ptr1),y
+        lda #$ff
+        ldy #st::stack_idx
+        sta (ptr1),y
+        ldy #st::options
+        lda (ptr1),y
+        and #<~opt_paused
+        sta (ptr1),y
+        jmp incsp2              ; tail call to remove arg from stack
+.endproc                ; _j65_reset
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;;                             j65_parse                            ;;
@@ -262,13 +526,33 @@ loop1:  lda (sp),y
         iny
         lda (sp),y
         sta state
-        sta strbuf
         iny
         lda (sp),y
         sta state+1
-        add #1                  ; strbuf is state+256
-        sta strbuf+1
         jsr incsp4              ; remove state and buf from C stack
+        getstate st::strbuf
+        sta strbuf
+        iny
+        lda (state),y
+        sta strbuf+1
+        ldy #st::file_off       ; remember where we started, for
+        lda (state),y           ; j65_get_consumed
+        ldy #st::start_off
+        sta (state),y
+        ldy #st::file_off+1
+        lda (state),y
+        ldy #st::start_off+1
+        sta (state),y
+        getstate st::options
+        and #opt_ring
+        beq nopending
+        getstate pending
+        beq nopending
+        jsr write_pending       ; ring has been drained; try again
+        cpx #J65_WANT_MORE
+        bne done
+nopending:
+        ldx #J65_WANT_MORE      ; status if there is nothing to parse
 loop:   lda jlen+1
         beq leftovers
         pha                     ; save jlen on 6502 stack
@@ -276,10 +560,7 @@ loop:   lda jlen+1
         pha
         lda #$ff
         sta inbuflast
-        jsr parse
-        tax
-        lda #$ff                ; increment file_off by 256
-        jsr add_a_plus_1_to_file_off
+        jsr parse_chunk
         pla                     ; restore jlen off 6502 stack
         sta jlen
         pla
@@ -288,29 +569,68 @@ loop:   lda jlen+1
         cpx #J65_WANT_MORE
         bne done                ; error or success; don't need to parse more
         inc inbuf+1             ; add 256 to inbuf
-        jmp loop
+        jra loop
 leftovers:                      ; hi byte of jlen is zero
-        ldx jlen
+        lda jlen
         beq done                ; if length was a multiple of 256
+        tax
         dex
         stx inbuflast
-        txa
-        pha
-        jsr parse
-        tax
-        pla
-        jsr add_a_plus_1_to_file_off
+        jsr parse_chunk
 done:   restore_regbank         ; restore regbank off of 6502 stack
         txa                     ; return value
         signextend
         rts
 .endproc                ; _j65_parse
 
-;; adds a plus 1 to file_off.
+;; calls parse, and then accounts for what it consumed.  if the ring
+;; filled up, the status is J65_RING_FULL, no matter how parse ended.
+;; if the callback yielded, the status is J65_YIELD, unless parse is
+;; done (or failed).
+;; returns status in x.  clobbers a and y.
+.proc parse_chunk
+        jsr parse
+        tax
+        jsr advance_file_off
+        getstate st::options
+        and #opt_paused | opt_yield
+        beq done
+        sta tmp1
+        eor (state),y           ; clear opt_paused and opt_yield
+        sta (state),y
+        ldy tmp1
+        cpy #opt_paused
+        bne yield
+        ldx #J65_RING_FULL
+done:   rts
+yield:  cpx #J65_DONE
+        beq done
+        txa
+        bmi done
+        ldx #J65_YIELD
+        rts
+.endproc                ; parse_chunk
+
+;; adds the bytes consumed by parse to file_off, which is charidx
+;; plus 1.  the byte parse stopped at is not counted if parse returned
+;; an error, since the offending byte has not been consumed, or if it
+;; returned J65_RING_FULL, since that byte must be parsed again.
+;; l_literal also returns J65_RING_FULL after the callback yields.
+;; the current position is then entirely in file_off, so cur_idx is
+;; cleared.
+;; status returned by parse is in x.
 ;; clobbers a and y.  preserves x.
-.proc add_a_plus_1_to_file_off
-        ldy #st::file_off
+.proc advance_file_off
+        lda #0
+        putstate st::cur_idx
+        cpx #J65_WANT_MORE+1    ; J65_DONE or J65_WANT_MORE?
+        bcc consumed
+        clc                     ; don't count the byte parse stopped at
+        bcc add                 ; always taken
+consumed:
         sec
+add:    lda charidx
+        ldy #st::file_off
         adc (state),y           ; file_off
         sta (state),y
         iny
@@ -326,7 +646,7 @@ done:   restore_regbank         ; restore regbank off of 6502 stack
         adc #0
         sta (state),y
         rts
-.endproc                ; add_a_plus_1_to_file_off
+.endproc                ; advance_file_off
 
 ;; x will contain character, and a will contain character properties
 ;; on exit. clobbers y.
@@ -477,17 +797,99 @@ charprops:
 
 ;; state, strbuf, inbuf, and inbuflast should be set up upon entry.
 ;; returns status in a.
+;; (the real work is done by parse1; this makes sure the hot state is
+;; written back no matter which way parse1 exits.  likewise for an
+;; integer which is being accumulated in long1, which is kept in
+;; long_val in between.  and a string being borrowed from inbuf is
+;; copied to strbuf, since inbuf won't be there next time.  and in
+;; J65_RECOVER mode, an error starts skipping the bad record.)
 .proc parse
+        jsr load_hot_state
+.if int_bits > 0
+        lda lexer_st
+        cmp #lex_int
+        bne run
+        ldy #st::long_val
+        .repeat int_bits / 8, i
+        lda (state),y
+        sta long1+i
+        iny
+        .endrep
+.endif
+run:    jsr parse1
+        pha                     ; save status
+        tax
+        bpl no_error
+        getstate st::options
+        and #J65_RECOVER
+        beq no_error
+        jsr start_recovery
+no_error:
+        lda lexer_st
+        cmp #lex_str_borrow
+        beq spill
+.if int_bits > 0
+        cmp #lex_int
+        bne done
+        ldy #st::long_val
+        .repeat int_bits / 8, i
+        lda long1+i
+        sta (state),y
+        iny
+        .endrep
+.endif
+done:   jsr store_hot_state
+        pla
+        rts
+spill:  ldx inbuflast           ; the rest of the chunk is in the string
+        inx
+        txa
+        jsr spill_view
+        jra done
+.endproc                ; parse
+
+;; copies the hot state variables from the state to zero page.
+;; clobbers a and y.  preserves x.
+.proc load_hot_state
+        ldy #st::lexer_st
+        .repeat 4, i
+        lda (state),y
+        sta hot_state+i
+        iny
+        .endrep
+        rts
+.endproc                ; load_hot_state
+
+;; copies the hot state variables from zero page back to the state.
+;; clobbers a and y.  preserves x.
+.proc store_hot_state
+        ldy #st::lexer_st
+        .repeat 4, i
+        lda hot_state+i
+        sta (state),y
+        iny
+        .endrep
+        rts
+.endproc                ; store_hot_state
+
+;; called by parse, with the hot state in zero page.
+.proc parse1
         lda #0
         sta charidx
 parseloop:
-        getstate st::lexer_st
-        tay
+.ifpc02
+        lda lexer_st
+        asl
+        tax
+        jmp (lex_tab,x)         ; jump table
+.else
+        ldy lexer_st
         lda lex_tab_h,y
         pha
         lda lex_tab_l,y
         pha
         rts                     ; jump table; not end of subroutine
+.endif
 l_ready:
         jsr getchar
         bmi got_whitespace
@@ -497,36 +899,39 @@ l_ready:
         asl
         asl
         asl
-        sta tmp1
-        getstate st::parser_st
-        ora tmp1
+        ora parser_st
+.ifpc02
+        asl
+        tax
+        jmp (dispatch_tab,x)    ; jump table
+.else
         tay
         lda dispatch_tab_h,y
         pha
         lda dispatch_tab_l,y
         pha
         rts                     ; jump table; not end of subroutine
+.endif
+.ifdef J65_NO_POSITIONS
+got_whitespace:                 ; lines aren't counted, so a newline is
+                                ; just another blank
+.else
 got_whitespace:
         cpx #$0d
         beq got_newline
         cpx #$0a
-        bne jmp_nextchar
-        getstate st::prev_char
+        bne got_blank
+        lda flags               ; last line ending seen (see below)
         cmp #$0d
-        beq got_newline1        ; ignore LF if preceded by CR
+        bne got_newline
+        jsr at_line_start
+        beq got_newline1        ; ignore LF if immediately preceded by CR
 got_newline:
         ldy #st::line_num       ; increment line number
         jsr inc_state_long
 got_newline1:
-        lda #0                  ; set column number to 0
-        ldy #st::col_num
-        sta (state),y
-        iny
-        sta (state),y
-        iny
-        sta (state),y
-        iny
-        sta (state),y
+        stx flags               ; flags is unused between values, so it
+                                ; remembers which line ending this was
         sec                     ; add 1 in make_byte_offset
         jsr make_byte_offset    ; get file offset+1 into regsave
         ldy #st::line_off       ; move regsave into line offset
@@ -541,41 +946,96 @@ got_newline1:
         iny
         lda regsave+3
         sta (state),y
-        jmp nextchar1
 jmp_nextchar:
         jmp nextchar
+.endif
+got_blank:                      ; skip a whole run of spaces and tabs
+        lda parser_st
+        cmp #par_done
+        beq jmp_nextchar        ; let nextchar finish up
+        ldy charidx
+blankloop:
+        cpy inbuflast
+        beq blank_wantmore      ; rest of the chunk was blank
+        iny
+        lda (inbuf),y
+        cmp #$20                ; space
+        beq blankloop
+        cmp #$09                ; tab
+        beq blankloop
+.ifdef J65_NO_POSITIONS
+        cmp #$0a                ; LF
+        beq blankloop
+        cmp #$0d                ; CR
+        beq blankloop
+.endif
+        sty charidx
+        jra l_ready             ; lexer state is still lex_ready
+blank_wantmore:
+        sty charidx
+        jmp wantmore
+.ifdef J65_NO_POSITIONS
+jmp_nextchar:
+        jmp nextchar
+.endif
 start_lit:
-        getstate st::parser_st
-        tay
+        sta flags               ; save char properties
+        ldy parser_st
         lda literal_errors,y
-        bne error
+        bne lit_error
+        sta str_idx             ; a is 0
+        lda flags
+        and #prop_int           ; a digit or a minus sign?
+        beq not_int
+.if int_bits > 0
+        jmp start_int
+.else
+        jra start_other         ; every number is a J65_NUMBER
+.endif
+not_int:
+        jmp start_keyword
+start_other:                    ; not an integer or keyword (so, an error)
         lda #prop_lit | prop_int | prop_num
-        putstate st::flags
-        lda #0
-        putstate st::str_idx
+        sta flags
         lda #lex_literal
-        putstate st::lexer_st   ; fall thru and process same char as literal
+        sta lexer_st            ; fall thru and process same char as literal
 l_literal:
+        jsr copy_literal_run    ; first, copy a run of literal chars
+        bcs jmp_nextchar        ; used up the chunk (or strbuf)
         jsr getchar
-        ldy #st::flags
-        and (state),y
+        and flags
         bne goodliteral
-        lda (state),y
-        tax
-        getstate st::str_idx
-        tay
+end_literal:
+        ldy str_idx
         lda #0
         sta (strbuf),y          ; null-terminate string
-        txa
+        lda flags
         jsr handle_literal
         bcs error
         lda #lex_ready
-        putstate st::lexer_st
-        jmp parseloop           ; process the same character again
+        sta lexer_st
+        getstate st::options
+        and #opt_paused
+        bne paused
+again:  jmp parseloop           ; process the same character again
+paused: lda parser_st           ; a top-level scalar is the last event,
+        cmp #par_done           ; so finish up (and return J65_DONE) as
+        beq again               ; if we hadn't paused
+        lda #J65_RING_FULL      ; ring is full (or callback yielded), so
+                                ; process it next time
+lit_error:
+        rts                     ; end of subroutine (or error exit)
 goodliteral:
-        sta (state),y           ; write back flags after and
+        sta flags               ; write back flags after and
         jmp putchar
 l_string:
+        getstate st::options
+        and #opt_validate
+        cmp #opt_validate
+        beq skip_run
+        jsr copy_string_run     ; first, copy a run of plain bytes
+run_done:
+        bcs str_nextchar        ; used up the chunk (or strbuf)
         jsr getchar
         and #prop_str
         beq illegal_char
@@ -583,66 +1043,79 @@ l_string:
         beq got_backslash
         cpx #$22                ; double quote
         beq got_quote
-        jmp putchar
+        jra strbuf_full         ; copy_string_run only stops here if full
 got_backslash:
         lda #lex_str_escape
-        putstate st::lexer_st
-        jmp nextchar
+        sta lexer_st
+str_nextchar:
+        jra nextchar
 got_quote:
         jsr handle_string
         bcs error
         lda #lex_ready
-        putstate st::lexer_st
-        jmp nextchar
+        sta lexer_st
+        jra nextchar
 illegal_char:
         lda #J65_ILLEGAL_CHAR
 error:  rts                     ; error exit
+skip_run:                       ; validating, so the string isn't kept
+        jsr skip_string_run
+        jra run_done
+strbuf_full:                    ; once there is room, start the run over
+        jsr make_room           ; from this char, so it still goes thru
+        bcs error               ; the UTF-8 check
+        jra l_string
 l_str_escape:
-        lda #lex_string
-        putstate st::lexer_st
         ldy charidx             ; don't need to jsr getchar; don't need props
         lda (inbuf),y
-        sta esc_code
-        cmp #$5c                ; backslash
-        beq escape_later
+.ifndef J65_NO_UNICODE_ESCAPES
         cmp #'u'
-        beq escape_later
+        beq jmp_start_hex
+.endif
+        sta esc_code
         jsr lookup_escape
         bcs illegal_escape
+.ifndef J65_NO_UNICODE_ESCAPES
+        bit flags               ; left surrogate waiting for a right one?
+        bmi jmp_lone_surrogate
+.endif
         tax
-        jmp putchar
+        ldy #st::str_max
+        lda (state),y
+        cmp str_idx
+        beq escape_full
+        txa
+        ldy str_idx
+        sta (strbuf),y
+        inc str_idx
+escaped:
+        lda #lex_string         ; not until the escape is stored, in case
+        sta lexer_st            ; we stop in escape_full and come back
+        jra nextchar
 illegal_escape:
         lda #J65_ILLEGAL_ESCAPE
         rts                     ; error exit
-escape_later:
-        lda #1
-        putstate st::flags      ; flag indicating we need a later escape pass
-        getstate st::str_idx    ; re-insert backslash first
-        tay
-        lda #$5c                ; backslash
-        sta (strbuf),y
-        iny
-        beq strtoolong
-        lda esc_code
-        jmp putchar1
+.ifndef J65_NO_UNICODE_ESCAPES
+jmp_start_hex:
+        jmp start_hex
+jmp_lone_surrogate:
+        jmp lone_surrogate
+.endif
+escape_full:
+        jsr make_room
+        bcs error3
+        jra l_str_escape        ; start this escape over
 putchar:                        ; x contains char to put in string buf
-        getstate st::str_idx
-        tay
+        ldy #st::str_max
+        lda (state),y
+        cmp str_idx
+        beq putchar_full
         txa
-putchar1:                       ; a contains char, y contains str_idx
+        ldy str_idx
         sta (strbuf),y
-        iny
-        beq strtoolong
-        tya
-        putstate st::str_idx
+        inc str_idx
 nextchar:
-        ldy #st::col_num
-        jsr inc_state_long
-nextchar1:
-        ldy charidx
-        lda (inbuf),y
-        putstate st::prev_char
-        getstate st::parser_st
+        lda parser_st
         cmp #par_done
         beq done
         lda charidx
@@ -655,9 +1128,16 @@ wantmore:
         rts                     ; end of subroutine
 done:   lda #J65_DONE
         rts                     ; end of subroutine
-strtoolong:
-        lda #J65_STRING_TOO_LONG
-        rts                     ; error exit
+putchar_full:
+        txa
+        pha                     ; save char
+        jsr make_room
+        tay
+        pla
+        tax
+        bcc putchar             ; try again
+        tya
+error3: rts                     ; error exit
 disp_illegal_char:
         lda #J65_ILLEGAL_CHAR
         rts                     ; error exit
@@ -679,10 +1159,21 @@ disp_exp_obj_end:
 disp_exp_array_end:
         lda #J65_EXPECTED_ARRAY_END
 error2: rts                     ; error exit
+unpush:                         ; the callback failed, so the '{' or '['
+        tax                     ; is not opened after all.  (J65_RECOVER
+        getstate st::stack_idx  ; parses it again, and must not count it
+        add #1                  ; twice.)
+        sta (state),y
+        txa
+        sec
 pop_and_error:
+.ifpc02
+        ply
+.else
         tax
         pla
         txa
+.endif
         rts                     ; error exit
 disp_start_obj:
         ldx #J65_START_OBJ
@@ -694,14 +1185,18 @@ descend:
         jsr push_state_stack
         bcs pop_and_error
         jsr call_callback
-        bcs pop_and_error
+        bcs unpush
+.ifpc02
+        plx
+.else
         pla
         tax
+.endif
         lda close_states,x
-        putstate st::parser_st
+        sta parser_st
         lda close_states+1,x
         putstate st::parser_st2
-        jmp nextchar
+        jra nextchar
 disp_end_obj:
         lda #J65_END_OBJ
 ascend: sta evtype
@@ -709,111 +1204,960 @@ ascend: sta evtype
         bcs error2
         jsr pop_state_stack
         bcs error2
-        putstate st::parser_st
+        sta parser_st
         putstate st::parser_st2
         jmp nextchar
 disp_start_array:
         ldx #J65_START_ARRAY
         lda #2                  ; index into close_states
-        jmp descend
+        jra descend
 disp_end_array:
         lda #J65_END_ARRAY
-        jmp ascend
+        jra ascend
 disp_start_string:
+        getstate st::options
+        tax
+        and #J65_CHECK_UTF8
+        asl
+        asl
+        asl                     ; J65_CHECK_UTF8 becomes str_check_utf8
+        sta flags               ; see start_hex
+        txa
+        and #J65_BORROW_STRINGS | opt_ring
+        cmp #J65_BORROW_STRINGS
+        beq jmp_start_borrow    ; (not in ring mode, which copies anyway,
+                                ; or when validating, which doesn't copy)
         lda #lex_string
-        putstate st::lexer_st
+        sta lexer_st
+.ifpc02
+        stz str_idx
+.else
         lda #0
-        putstate st::flags      ; boolean for second unescape pass
-        putstate st::str_idx
+        sta str_idx
+.endif
         jmp nextchar
+jmp_start_borrow:
+        jra start_borrow
 disp_comma_array:
         lda #par_ready
-dca1:   putstate st::parser_st
+dca1:   sta parser_st
         jmp nextchar
 disp_comma_object:
         lda #par_key
-        jmp dca1
+        jra dca1
 disp_colon:
         lda #par_ready
-        jmp dca1
-
-        .rodata
-
-.define lex_tab l_ready-1, l_literal-1, l_string-1, l_str_escape-1
-lex_tab_l:
-        .lobytes lex_tab
-lex_tab_h:
-        .hibytes lex_tab
-.undefine lex_tab
-
-flags_prop_lit_or_num:
-        .byte prop_lit | prop_int | prop_num
-
-.define dt_none  disp_illegal_char-1,disp_illegal_char-1,disp_illegal_char-1,disp_illegal_char-1,disp_illegal_char-1,disp_illegal_char-1,disp_illegal_char-1,disp_illegal_char-1
-.define dt_lsq   disp_start_array-1,disp_start_array-1,disp_exp_string-1,disp_exp_string-1,disp_exp_colon-1,disp_exp_comma-1,disp_exp_comma-1,disp_parse_error-1
-.define dt_lcur  disp_start_obj-1,disp_start_obj-1,disp_exp_string-1,disp_exp_string-1,disp_exp_colon-1,disp_exp_comma-1,disp_exp_comma-1,disp_parse_error-1
-.define dt_rsq   disp_parse_error-1,disp_end_array-1,disp_exp_string-1,disp_exp_obj_end-1,disp_exp_colon-1,disp_end_array-1,disp_exp_obj_end-1,disp_parse_error-1
-.define dt_rcur  disp_parse_error-1,disp_exp_array_end-1,disp_exp_string-1,disp_end_obj-1,disp_exp_colon-1,disp_exp_array_end-1,disp_end_obj-1,disp_parse_error-1
-.define dt_colon disp_parse_error-1,disp_parse_error-1,disp_exp_string-1,disp_exp_string-1,disp_colon-1,disp_exp_comma-1,disp_exp_comma-1,disp_parse_error-1
-.define dt_comma disp_parse_error-1,disp_parse_error-1,disp_exp_string-1,disp_exp_string-1,disp_exp_colon-1,disp_comma_array-1,disp_comma_object-1,disp_parse_error-1
-.define dt_quote disp_start_string-1,disp_start_string-1,disp_start_string-1,disp_start_string-1,disp_exp_colon-1,disp_exp_comma-1,disp_exp_comma-1,disp_parse_error-1
-dispatch_tab_l:
-        .lobytes dt_none
-        .lobytes dt_lsq
-        .lobytes dt_lcur
-        .lobytes dt_rsq
-        .lobytes dt_rcur
-        .lobytes dt_colon
-        .lobytes dt_comma
-        .lobytes dt_quote
-dispatch_tab_h:
-        .hibytes dt_none
-        .hibytes dt_lsq
-        .hibytes dt_lcur
-        .hibytes dt_rsq
-        .hibytes dt_rcur
-        .hibytes dt_colon
-        .hibytes dt_comma
-        .hibytes dt_quote
-
-.undefine dt_none
-.undefine dt_lsq
-.undefine dt_lcur
-.undefine dt_rsq
-.undefine dt_rcur
-.undefine dt_colon
-.undefine dt_comma
-.undefine dt_quote
-
-close_states:
-        .byte par_key_or_close_object, par_need_comma_or_close_object
-        .byte par_ready_or_close_array, par_need_comma_or_close_array
-
-literal_errors:                 ; needs to match parser state enum
-        .byte 0, 0, J65_EXPECTED_STRING, J65_EXPECTED_STRING, J65_EXPECTED_COLON
-        .byte J65_EXPECTED_COMMA, J65_EXPECTED_COMMA, J65_PARSE_ERROR
-
-        .code
-
-.endproc                ; parse
-
-;; event type is in evtype.
-;; Returns callback's return value in a.
-;; Sets carry if return value is negative.
-;; clobbers all regs.
-.proc call_callback
-        lda inbuflast           ; save caller-save regs
-        pha
-        lda charidx
-        pha
-
-        ldy #st::callback       ; get callback into ptr4
-        lda (state),y
-        sta ptr4
-        iny
-        lda (state),y
-        sta ptr4+1
-
+        jra dca1
+start_borrow:                   ; leave the string in inbuf for now
+        ldx charidx
+        inx
+        stx str_idx             ; str_idx is where it starts in inbuf
+        lda #lex_str_borrow
+        sta lexer_st
+        jmp nextchar
+l_str_borrow:                   ; skip over plain bytes, without copying
+        ldx inbuflast           ; stop at the end of the chunk, or
+        getstate st::str_max    ; where the string would no longer fit
+        add str_idx             ; in strbuf, whichever comes first
+        bcs got_last
+        sub #1
+        cmp inbuflast
+        bcs got_last
+        tax
+got_last:
+        stx tmp1
+        ldy charidx
+borrow_loop:
+        lda (inbuf),y
+        bmi borrow_high         ; non-ascii char, legal in strings
+        cmp #$20
+        blt borrow_special      ; control char (illegal)
+        cmp #$22                ; double quote
+        beq borrow_end
+        cmp #$5c                ; backslash
+        beq borrow_special
+borrow_plain:
+        cpy tmp1                ; the last byte to borrow
+        beq borrow_more         ; end of chunk (or strbuf would be full)
+        iny
+        bne borrow_loop         ; always taken
+borrow_more:
+        cpy inbuflast
+        bne borrow_full
+        sty charidx             ; parse will copy what we have to strbuf
+        jmp nextchar
+borrow_full:                    ; copy the string to strbuf, which fills
+        iny                     ; it, and let l_string deal with the next
+        sty charidx             ; char
+        tya
+        jsr spill_view
+        jmp l_string
+borrow_high:
+        bit flags
+        bvc borrow_plain        ; not checking UTF-8
+        jsr check_utf8
+        bcc borrow_plain
+        sty charidx             ; copy the string up to the bad byte, so
+        tya                     ; parse doesn't spill the whole chunk
+        jsr spill_view          ; into strbuf, which may be small
+        lda #J65_ILLEGAL_UTF8
+        rts                     ; error exit
+borrow_special:                 ; copy what we have to strbuf, and let
+        sty charidx             ; l_string deal with this char
+        tya
+        jsr spill_view
+        jmp l_string
+borrow_end:
+        sty charidx
+        lda str_idx             ; point long_val at the string in inbuf
+        add inbuf
+        putstate st::long_val
+        lda inbuf+1
+        adc #0
+        putstate st::long_val+1
+        lda charidx
+        sub str_idx
+        sta str_idx             ; length
+        jmp got_quote
+l_recover:                      ; skip to the end of a bad record
+        ldy charidx             ; don't need to jsr getchar; don't need props
+        lda (inbuf),y
+        cmp #$0a
+        beq rec_newline
+        cmp #$0d
+        beq rec_newline
+        bit flags
+        bmi rec_string
+        cmp #$22                ; double quote
+        beq rec_quote
+        cmp #'['
+        beq rec_open
+        cmp #'{'
+        beq rec_open
+        cmp #']'
+        beq rec_close
+        cmp #'}'
+        beq rec_close
+        jmp nextchar
+rec_open:
+        inc str_idx
+        jmp nextchar
+rec_close:
+        lda str_idx
+        beq rec_end             ; close at the top level
+        dec str_idx
+        beq rec_end             ; matching close at the top level
+        jmp nextchar
+rec_quote:
+        lda #$80
+        sta flags
+        jmp nextchar
+rec_string:
+        ldx flags
+        cpx #$c0
+        beq rec_escaped         ; after a backslash, so skip this char
+        cmp #$5c                ; backslash
+        beq rec_backslash
+        cmp #$22                ; double quote
+        beq rec_string_end
+        jmp nextchar
+rec_escaped:
+        lda #$80                ; still in the string
+        sta flags
+        jmp nextchar
+rec_backslash:
+        lda #$c0
+        sta flags
+        jmp nextchar
+rec_string_end:
+        lda #0
+        sta flags
+        jmp nextchar
+rec_newline:                    ; records can't have newlines in them
+        jsr rec_reset           ; (outside of whitespace), so this is
+        jmp parseloop           ; the end; count the newline, too
+rec_end:
+        jsr rec_reset
+        jmp nextchar
+rec_reset:                      ; the parser starts over, like j65_reset
+        lda #0
+        sta lexer_st            ; lex_ready
+        sta parser_st           ; par_ready
+        sta str_idx
+        sta flags
+        putstate st::skip_idx
+        putstate st::skip_on
+        lda #par_done
+        putstate st::parser_st2
+        lda #$ff
+        putstate st::stack_idx
+        rts
+.ifndef J65_NO_UNICODE_ESCAPES
+start_hex:                      ; \u, so 4 hex digits follow.  in a
+        lda flags               ; string, the low bits of flags count
+        ora #4                  ; the digits left to read, and the high
+        sta flags               ; bit means a left surrogate is waiting.
+                                ; (the low bits can't be holding UTF-8
+                                ; state; see check_utf8)
+        lda #lex_str_hex
+        sta lexer_st
+        jmp nextchar
+l_str_hex:                      ; accumulate the digits in long_val
+        lda flags
+        and #str_count
+        beq hex_done            ; already have all 4 (coming back after
+        ldy charidx             ; make_room)
+        lda (inbuf),y
+        jsr hex_dig_to_nibble
+        bcs bad_hex
+        pha
+        ldy #st::long_val
+        lda (state),y
+        sta sreg
+        iny
+        lda (state),y
+        sta sreg+1
+        jsr shift_sreg_left_4bits
+        lda sreg+1
+        sta (state),y
+        dey
+        pla
+        ora sreg
+        sta (state),y
+        dec flags
+        lda flags
+        and #str_count
+        beq hex_done
+        jmp nextchar
+bad_hex:
+        lda #J65_ILLEGAL_ESCAPE
+        rts                     ; error exit
+hex_done:                       ; code unit is in long_val, and a left
+        ldy #st::long_val+1     ; surrogate before it (if any) is in
+        lda (state),y           ; long_val+2
+        and #$fc
+        tax                     ; $d8 if left surrogate, $dc if right
+        bit flags
+        bpl no_left
+        cpx #$dc
+        bne not_pair
+        ldy #st::long_val       ; a surrogate pair, so combine them
+        lda (state),y
+        sta sreg
+        iny
+        lda (state),y
+        sta sreg+1
+        iny
+        lda (state),y
+        sta long1
+        iny
+        lda (state),y
+        sta long1+1
+        lda #0
+        sta long1+3
+        jsr combine_surrogates
+        jsr put_utf8
+        bcs hex_full
+        lda flags               ; used up the left surrogate
+        and #<~$80
+        sta flags
+        jra hex_end
+not_pair:
+        jsr put_surrogate       ; the left one goes by itself
+        bcs hex_error
+        jra hex_done            ; now this one
+no_left:
+        cpx #$d8
+        beq left
+        ldy #st::long_val
+        lda (state),y
+        sta long1
+        iny
+        lda (state),y
+        sta long1+1
+        lda #0
+        sta long1+2
+        sta long1+3
+        jsr put_utf8
+        bcs hex_full
+hex_end:
+        lda #lex_string
+        sta lexer_st
+        jmp nextchar
+left:   ldy #st::long_val       ; hold on to it, in case a right
+        lda (state),y           ; surrogate comes next
+        ldy #st::long_val+2
+        sta (state),y
+        ldy #st::long_val+1
+        lda (state),y
+        ldy #st::long_val+3
+        sta (state),y
+        lda flags               ; left surrogate is waiting
+        ora #$80
+        sta flags
+        lda #lex_str_surrogate
+        sta lexer_st
+        jmp nextchar
+hex_full:
+        jsr make_room
+        bcs hex_error
+        jmp hex_done
+hex_error:
+        rts                     ; error exit
+l_str_surrogate:
+        ldy charidx             ; don't need to jsr getchar; don't need props
+        lda (inbuf),y
+        cmp #$5c                ; backslash, which might start a right
+        bne lone_left           ; surrogate
+        lda #lex_str_escape
+        sta lexer_st
+        jmp nextchar
+lone_left:
+        jsr put_surrogate
+        bcs hex_error
+        lda #lex_string
+        sta lexer_st
+        jmp l_string            ; process the same char in the string
+lone_surrogate:                 ; a left surrogate, and then an escape
+        jsr put_surrogate       ; which is not \u
+        bcs hex_error
+        jmp l_str_escape        ; now the escape
+.endif
+start_keyword:
+        ldy #kw_null - keywords
+        cpx #'n'
+        beq keyword
+        ldy #kw_true - keywords
+        cpx #'t'
+        beq keyword
+        ldy #kw_false - keywords
+        cpx #'f'
+        beq keyword
+        jmp start_other
+keyword:
+        iny                     ; first letter matched
+        sty str_idx             ; str_idx is the index into keywords
+        lda #lex_keyword
+        sta lexer_st
+        jmp nextchar
+l_keyword:                      ; match each letter against keywords
+        ldy str_idx
+        lda keywords,y
+        bmi kw_end
+        ldy charidx
+        cmp (inbuf),y
+        bne kw_mismatch
+        inc str_idx
+        jmp nextchar
+kw_end: jsr getchar             ; all letters matched; this char has
+        and #prop_lit           ; to end the literal
+        bne kw_mismatch
+        ldy str_idx
+        lda keywords,y
+        and #$7f                ; event number
+        ora #prop_lit           ; goes in flags, for handle_literal
+        sta flags
+        lda #0                  ; nothing in strbuf (str_idx was an
+        sta str_idx             ; index into keywords, maybe past str_max)
+        jmp end_literal
+kw_mismatch:                    ; not a keyword after all.  put what
+        ldx str_idx             ; matched so far into strbuf, and let
+find:   dex                     ; l_literal deal with the rest (which
+        bmi found               ; will be an error)
+        lda keywords,x
+        bpl find
+found:  inx                     ; start of this keyword
+        ldy #0
+copy:   cpx str_idx
+        beq copied
+        lda keywords,x
+        sta (strbuf),y
+        inx
+        iny
+        bne copy                ; always taken
+copied: sty str_idx
+        lda #prop_lit
+        sta flags
+        lda #lex_literal
+        sta lexer_st
+        jmp l_literal
+.if int_bits > 0
+start_int:                      ; start accumulating an integer
+        getstate st::options
+        and #opt_validate
+        cmp #opt_validate
+        bne convert
+        jmp start_other         ; no need to convert it when validating
+convert:
+.ifpc02
+        stz long1
+        stz long1+1
+.if int_bits = 32
+        stz long1+2
+        stz long1+3
+.endif
+.else
+        lda #0
+        sta long1
+        sta long1+1
+.if int_bits = 32
+        sta long1+2
+        sta long1+3
+.endif
+.endif
+        lda #prop_int | prop_num
+        sta flags
+        lda #lex_int
+        sta lexer_st            ; fall thru and process same char as integer
+l_int:                          ; digits go into long1 as well as strbuf
+        ldy charidx
+        lda (inbuf),y
+        tax
+        eor #'0'
+        cmp #10
+        bge not_digit
+        sta tmp1                ; value of digit
+.if int_bits = 16
+        lda long1               ; long1 = long1 * 10 + digit, in 16 bits
+        sta long2
+        lda long1+1
+        sta long2+1
+        asl long1               ; * 2
+        rol long1+1
+        bcs int_overflow
+        asl long1               ; * 4
+        rol long1+1
+        bcs int_overflow
+        lda long1               ; * 5
+        adc long2               ; (carry is clear)
+        sta long1
+        lda long1+1
+        adc long2+1
+        sta long1+1
+        bcs int_overflow
+        asl long1               ; * 10
+        rol long1+1
+        bcs int_overflow
+        lda long1
+        adc tmp1                ; (carry is clear)
+        sta long1
+        bcc jmp_putchar
+        inc long1+1
+        bne jmp_putchar
+.else
+        lda long1               ; long1 = long1 * 10 + digit
+        sta long2
+        lda long1+1
+        sta long2+1
+        lda long1+2
+        sta long2+2
+        lda long1+3
+        sta long2+3
+        asl long1               ; * 2
+        rol long1+1
+        rol long1+2
+        rol long1+3
+        bcs int_overflow
+        asl long1               ; * 4
+        rol long1+1
+        rol long1+2
+        rol long1+3
+        bcs int_overflow
+        lda long1               ; * 5
+        adc long2               ; (carry is clear)
+        sta long1
+        lda long1+1
+        adc long2+1
+        sta long1+1
+        lda long1+2
+        adc long2+2
+        sta long1+2
+        lda long1+3
+        adc long2+3
+        sta long1+3
+        bcs int_overflow
+        asl long1               ; * 10
+        rol long1+1
+        rol long1+2
+        rol long1+3
+        bcs int_overflow
+        lda long1
+        adc tmp1                ; (carry is clear)
+        sta long1
+        bcc jmp_putchar
+        inc long1+1
+        bne jmp_putchar
+        inc long1+2
+        bne jmp_putchar
+        inc long1+3
+        bne jmp_putchar
+.endif
+int_overflow:                   ; too big for int_bits; it will be a
+        lda #lex_literal        ; J65_NUMBER, but let l_literal and
+        sta lexer_st            ; handle_literal work that out
+jmp_putchar:
+        jmp putchar
+not_digit:
+        cpx #'-'                ; a minus sign is only okay at the start
+        bne not_minus
+        lda str_idx
+        beq jmp_putchar
+not_minus:
+        jsr getchar
+        and flags
+        bne not_integer
+        jmp end_literal         ; end of the integer
+not_integer:
+        lda #lex_literal        ; not just digits after all; let
+        sta lexer_st            ; l_literal deal with the rest
+        jmp l_literal
+.endif                          ; int_bits > 0
+
+        .rodata
+
+.ifpc02
+lex_tab:                        ; needs to match lexer state enum
+        .addr l_ready, l_literal
+.if int_bits > 0
+        .addr l_int
+.endif
+        .addr l_keyword, l_string, l_str_escape
+.ifndef J65_NO_UNICODE_ESCAPES
+        .addr l_str_hex, l_str_surrogate
+.endif
+        .addr l_str_borrow, l_recover
+.else
+lex_tab_l:                      ; needs to match lexer state enum
+        .lobytes l_ready-1, l_literal-1
+.if int_bits > 0
+        .lobytes l_int-1
+.endif
+        .lobytes l_keyword-1, l_string-1, l_str_escape-1
+.ifndef J65_NO_UNICODE_ESCAPES
+        .lobytes l_str_hex-1, l_str_surrogate-1
+.endif
+        .lobytes l_str_borrow-1, l_recover-1
+lex_tab_h:
+        .hibytes l_ready-1, l_literal-1
+.if int_bits > 0
+        .hibytes l_int-1
+.endif
+        .hibytes l_keyword-1, l_string-1, l_str_escape-1
+.ifndef J65_NO_UNICODE_ESCAPES
+        .hibytes l_str_hex-1, l_str_surrogate-1
+.endif
+        .hibytes l_str_borrow-1, l_recover-1
+.endif
+
+flags_prop_lit_or_num:
+        .byte prop_lit | prop_int | prop_num
+
+keywords:                       ; for l_keyword; each ends with $80 | event
+kw_null:
+        .byte "null", $80 | J65_NULL
+kw_true:
+        .byte "true", $80 | J65_TRUE
+kw_false:
+        .byte "false", $80 | J65_FALSE
+
+.define dt_none  disp_illegal_char-tab_adj,disp_illegal_char-tab_adj,disp_illegal_char-tab_adj,disp_illegal_char-tab_adj,disp_illegal_char-tab_adj,disp_illegal_char-tab_adj,disp_illegal_char-tab_adj,disp_illegal_char-tab_adj
+.define dt_lsq   disp_start_array-tab_adj,disp_start_array-tab_adj,disp_exp_string-tab_adj,disp_exp_string-tab_adj,disp_exp_colon-tab_adj,disp_exp_comma-tab_adj,disp_exp_comma-tab_adj,disp_parse_error-tab_adj
+.define dt_lcur  disp_start_obj-tab_adj,disp_start_obj-tab_adj,disp_exp_string-tab_adj,disp_exp_string-tab_adj,disp_exp_colon-tab_adj,disp_exp_comma-tab_adj,disp_exp_comma-tab_adj,disp_parse_error-tab_adj
+.define dt_rsq   disp_parse_error-tab_adj,disp_end_array-tab_adj,disp_exp_string-tab_adj,disp_exp_obj_end-tab_adj,disp_exp_colon-tab_adj,disp_end_array-tab_adj,disp_exp_obj_end-tab_adj,disp_parse_error-tab_adj
+.define dt_rcur  disp_parse_error-tab_adj,disp_exp_array_end-tab_adj,disp_exp_string-tab_adj,disp_end_obj-tab_adj,disp_exp_colon-tab_adj,disp_exp_array_end-tab_adj,disp_end_obj-tab_adj,disp_parse_error-tab_adj
+.define dt_colon disp_parse_error-tab_adj,disp_parse_error-tab_adj,disp_exp_string-tab_adj,disp_exp_string-tab_adj,disp_colon-tab_adj,disp_exp_comma-tab_adj,disp_exp_comma-tab_adj,disp_parse_error-tab_adj
+.define dt_comma disp_parse_error-tab_adj,disp_parse_error-tab_adj,disp_exp_string-tab_adj,disp_exp_string-tab_adj,disp_exp_colon-tab_adj,disp_comma_array-tab_adj,disp_comma_object-tab_adj,disp_parse_error-tab_adj
+.define dt_quote disp_start_string-tab_adj,disp_start_string-tab_adj,disp_start_string-tab_adj,disp_start_string-tab_adj,disp_exp_colon-tab_adj,disp_exp_comma-tab_adj,disp_exp_comma-tab_adj,disp_parse_error-tab_adj
+.ifpc02
+dispatch_tab:
+        .addr dt_none
+        .addr dt_lsq
+        .addr dt_lcur
+        .addr dt_rsq
+        .addr dt_rcur
+        .addr dt_colon
+        .addr dt_comma
+        .addr dt_quote
+.else
+dispatch_tab_l:
+        .lobytes dt_none
+        .lobytes dt_lsq
+        .lobytes dt_lcur
+        .lobytes dt_rsq
+        .lobytes dt_rcur
+        .lobytes dt_colon
+        .lobytes dt_comma
+        .lobytes dt_quote
+dispatch_tab_h:
+        .hibytes dt_none
+        .hibytes dt_lsq
+        .hibytes dt_lcur
+        .hibytes dt_rsq
+        .hibytes dt_rcur
+        .hibytes dt_colon
+        .hibytes dt_comma
+        .hibytes dt_quote
+.endif
+
+.undefine dt_none
+.undefine dt_lsq
+.undefine dt_lcur
+.undefine dt_rsq
+.undefine dt_rcur
+.undefine dt_colon
+.undefine dt_comma
+.undefine dt_quote
+
+close_states:
+        .byte par_key_or_close_object, par_need_comma_or_close_object
+        .byte par_ready_or_close_array, par_need_comma_or_close_array
+
+literal_errors:                 ; needs to match parser state enum
+        .byte 0, 0, J65_EXPECTED_STRING, J65_EXPECTED_STRING, J65_EXPECTED_COLON
+        .byte J65_EXPECTED_COMMA, J65_EXPECTED_COMMA, J65_PARSE_ERROR
+
+        .code
+
+.endproc                ; parse1
+
+;; copies a run of plain string bytes (anything legal in a string
+;; except double quote and backslash) from inbuf to strbuf, starting at
+;; charidx, and updates charidx and str_idx once at the end of the run.
+;; returns carry clear if it stopped at a byte which needs special
+;; handling (charidx points at it), or carry set if it consumed
+;; everything up to and including charidx (either the end of the chunk
+;; was reached, or strbuf is full).  with J65_CHECK_UTF8, invalid
+;; UTF-8 doesn't return at all: it pops l_string's return address, and
+;; returns J65_ILLEGAL_UTF8 from parse1, with charidx at the bad byte.
+;; clobbers all registers and ptr1.
+.proc copy_string_run
+        jsr resume_utf8         ; first, finish any UTF-8 char from the
+        bcs utf8_error          ; last chunk
+        getstate st::str_max
+        sub str_idx             ; room left in strbuf
+        beq special             ; full; let l_string deal with it
+        tax
+        lda str_idx             ; point ptr1 at strbuf + str_idx - charidx,
+        sub charidx             ; so (ptr1),y is where (inbuf),y goes
+        sta ptr1
+        lda strbuf+1
+        sbc #0
+        sta ptr1+1
+        lda ptr1
+        add strbuf
+        sta ptr1
+        bcc start
+        inc ptr1+1
+start:  ldy charidx
+loop:   lda (inbuf),y
+        bmi high                ; non-ascii char, legal in strings
+        cmp #$20
+        blt end_run             ; control char (illegal)
+        cmp #$22                ; double quote
+        beq end_run
+        cmp #$5c                ; backslash
+        beq end_run
+plain:  sta (ptr1),y
+        dex
+        beq consumed            ; strbuf is full
+        cpy inbuflast
+        beq consumed            ; end of chunk
+        iny
+        bne loop                ; always taken
+high:   bit flags
+        bvc plain               ; not checking UTF-8
+        jsr check_utf8
+        bcc plain
+utf8_error:
+        sty charidx
+        pla                     ; return from parse1, rather than to
+        pla                     ; l_string
+        lda #J65_ILLEGAL_UTF8
+        rts                     ; error exit
+consumed:
+        sec
+        bcs save                ; always taken
+end_run:
+        clc
+save:   sty charidx
+        php                     ; save return value
+        stx tmp1
+        getstate st::str_max
+        sub tmp1                ; minus the room left
+        sta str_idx
+        plp
+        rts
+special:
+        clc
+        rts
+.endproc                ; copy_string_run
+
+;; copies a run of literal chars (ones which have some of the
+;; properties still in flags) from inbuf to strbuf, starting at
+;; charidx, and narrows down flags as it goes, just as l_literal does
+;; for one char.  updates charidx and str_idx once at the end of the
+;; run.  returns carry clear if it stopped at a char which is not part
+;; of the literal (charidx points at it), or carry set if it consumed
+;; everything up to and including charidx (either the end of the chunk
+;; was reached, or strbuf is full).
+;; clobbers all registers, ptr1, and tmp1.
+.proc copy_literal_run
+        getstate st::str_max
+        sub str_idx             ; room left in strbuf
+        beq special             ; full; let putchar report the error
+        sta tmp1
+        lda str_idx             ; point ptr1 at strbuf + str_idx - charidx,
+        sub charidx             ; so (ptr1),y is where (inbuf),y goes
+        sta ptr1
+        lda strbuf+1
+        sbc #0
+        sta ptr1+1
+        lda ptr1
+        add strbuf
+        sta ptr1
+        bcc start
+        inc ptr1+1
+start:  ldy charidx
+loop:   lda (inbuf),y
+        bmi end_run             ; non-ascii char, only legal in strings
+        tax
+        lda getchar::charprops,x
+        and flags
+        beq end_run
+        sta flags
+        txa
+        sta (ptr1),y
+        dec tmp1
+        beq consumed            ; strbuf is full
+        cpy inbuflast
+        beq consumed            ; end of chunk
+        iny
+        bne loop                ; always taken
+consumed:
+        sec
+        bcs save                ; always taken
+end_run:
+        clc
+save:   sty charidx
+        php                     ; save return value
+        getstate st::str_max
+        sub tmp1                ; minus the room left
+        sta str_idx
+        plp
+        rts
+special:
+        clc
+        rts
+.endproc                ; copy_literal_run
+
+;; like copy_string_run, but for j65_init_validate: skips over the run
+;; without copying it to strbuf, so there is no limit on its length.
+;; returns carry clear if it stopped at a byte which needs special
+;; handling (charidx points at it), or carry set if it consumed the
+;; rest of the chunk.  invalid UTF-8 is handled as in copy_string_run.
+;; clobbers a and y.
+.proc skip_string_run
+        jsr resume_utf8
+        bcs utf8_error
+        ldy charidx
+loop:   lda (inbuf),y
+        bmi high                ; non-ascii char, legal in strings
+        cmp #$20
+        blt special             ; control char (illegal)
+        cmp #$22                ; double quote
+        beq special
+        cmp #$5c                ; backslash
+        beq special
+plain:  cpy inbuflast
+        beq consumed            ; end of chunk
+        iny
+        bne loop                ; always taken
+high:   bit flags
+        bvc plain               ; not checking UTF-8
+        jsr check_utf8
+        bcc plain
+utf8_error:
+        jmp copy_string_run::utf8_error
+consumed:
+        sty charidx
+        sec
+        rts
+special:
+        sty charidx
+        clc
+        rts
+.endproc                ; skip_string_run
+
+;; with J65_CHECK_UTF8, checks the byte at charidx if a UTF-8 char was
+;; left unfinished at the end of the last chunk.  it must not be an
+;; ascii char.  (check_utf8 makes sure of that within a chunk.)
+;; returns carry set if the UTF-8 is invalid, with charidx in y.
+;; clobbers a and y.  preserves x.
+.proc resume_utf8
+        lda flags
+        and #str_count
+        beq ok                  ; not in the middle of a char
+        ldy charidx
+        lda (inbuf),y
+        bpl bad
+ok:     clc
+        rts
+bad:    sec
+        rts
+.endproc                ; resume_utf8
+
+;; checks one non-ascii byte of a string (in a, at index y in inbuf)
+;; against the UTF-8 state in the low bits of flags, and moves the
+;; state along.  the state is 0 between chars.  otherwise it says how
+;; many continuation bytes are still to come, and which ones are
+;; allowed next, so overlong encodings, surrogates, and code points
+;; past U+10FFFF are all rejected:
+;;   1, 2, 3   1, 2, or 3 more continuation bytes ($80-$BF)
+;;   4         after $E0; 2 more, the next one $A0-$BF
+;;   5         after $ED; 2 more, the next one $80-$9F
+;;   6         after $F0; 3 more, the next one $90-$BF
+;;   7         after $F4; 3 more, the next one $80-$8F
+;; if the char isn't finished, the next byte must not be ascii.  that
+;; is checked here if the next byte is in this chunk, or by
+;; resume_utf8 at the start of the next one.
+;; returns carry clear if the byte is valid.  otherwise, returns carry
+;; set, with the index of the offending byte in y.
+;; preserves a and x.  clobbers y only on error.
+.proc check_utf8
+        sta tmp5
+        stx tmp6
+        lda flags
+        and #str_count
+        tax                     ; utf8 state
+        lda tmp5
+        cmp utf8_lo,x
+        blt bad
+        cmp utf8_top,x
+        bge bad
+        cpx #0
+        beq lead
+        lda utf8_next,x
+        tax
+        jra update
+lead:   ldx #1                  ; $C2-$DF
+        cmp #$e0
+        blt update
+        sbc #$e0                ; $E0-$F4 (carry is set)
+        tax
+        lda utf8_lead,x
+        tax
+update: lda flags
+        and #<~str_count
+        sta flags
+        txa
+        beq done                ; that was the last byte of the char
+        ora flags
+        sta flags
+        cpy inbuflast
+        beq done                ; next byte is in the next chunk
+        iny
+        lda (inbuf),y
+        bpl bad                 ; char cut short by an ascii char
+        dey
+done:   lda tmp5
+        ldx tmp6
+        clc
+        rts
+bad:    lda tmp5
+        ldx tmp6
+        sec
+        rts
+
+        .rodata
+utf8_lo:                        ; lowest byte allowed in each state
+        .byte $c2, $80, $80, $80, $a0, $80, $90, $80
+utf8_top:                       ; 1 more than the highest byte allowed
+        .byte $f5, $c0, $c0, $c0, $c0, $a0, $c0, $90
+utf8_next:                      ; state after a continuation byte
+        .byte 0, 0, 1, 2, 1, 1, 2, 2
+utf8_lead:                      ; state after a lead byte from $E0 to $F4
+        .byte 4, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 5, 2, 2
+        .byte 6, 3, 3, 3, 7
+        .code
+.endproc                ; check_utf8
+
+;; event type is in evtype.
+;; Returns callback's return value in a.
+;; Sets carry if return value is negative.
+;; If the callback returns J65_SKIP, starts skipping, and returns 0.
+;; If it returns J65_YIELD, makes parse stop after this char, and
+;; returns 0.
+;; While skipping, the callback is not called, and 0 is returned.
+;; In ring mode, nothing is called; see ring_event.
+;; clobbers all regs.
+.proc call_callback
+        getstate st::skip_on
+        beq not_skipping
+skipping:                       ; skip_idx is 1 more than the stack_idx
+        getstate st::skip_idx   ; of the value being skipped, which is
+        sub #1                  ; -1 for the value of a key at depth 255,
+        blt scalar              ; so anything is shallower than that
+        ldy #st::stack_idx
+        cmp (state),y
+        blt scalar              ; shallower than the skipped value
+        bne suppress            ; inside the skipped value
+        lda evtype              ; at the depth of the value being skipped
+        cmp #J65_END_OBJ
+        beq stop_skipping
+        cmp #J65_END_ARRAY
+        beq stop_skipping
+        bne suppress
+scalar: lda evtype              ; the value following a key was a scalar
+        cmp #J65_STRING_PART
+        beq suppress            ; there is more of the string to come
+stop_skipping:
+        lda #0
+        putstate st::skip_on
+suppress:
+        lda #0
+        clc
+        rts                     ; end of subroutine
+not_skipping:
+        ldy #st::callback       ; get callback into ptr1
+        lda (state),y
+        sta ptr1
+        iny
+        lda (state),y
+        sta ptr1+1
+        getstate st::options
+        asl                     ; opt_handlers into carry, opt_ring into n
+        bpl not_ring
+        bcs suppress            ; both, so validating; there is no callback
+        jmp ring_event          ; tail call
+not_ring:
+        bcc have_callback
+        lda evtype              ; ptr1 is a table of handlers; look up
+        asl                     ; the one for this event
+        tay
+        lda (ptr1),y
+        tax
+        iny
+        lda (ptr1),y
+        stx ptr1
+        sta ptr1+1
+        ora ptr1
+        beq suppress            ; no handler for this event
+have_callback:
+        jsr store_hot_state     ; the callback may look at (or clobber) these
+        lda charidx             ; so the column can be worked out
+        putstate st::cur_idx
+        lda inbuflast           ; save caller-save regs
+        pha
+        lda charidx
+        pha
+        lda evtype              ; needed if callback returns J65_SKIP
+        pha
+
+        lda ptr1                ; move callback into ptr4
+        sta ptr4
+        lda ptr1+1
+        sta ptr4+1
+
         lda state               ; state ptr is passed on stack
         ldx state+1
         jsr pushax
@@ -823,18 +2167,289 @@ literal_errors:                 ; needs to match parser state enum
         jsr callptr4            ; call the C callback function (in ptr4)
 
         tax                     ; save return value
+        jsr load_hot_state
         pla                     ; restore caller-save regs
+        sta evtype
+        pla
         sta charidx
         pla
         sta inbuflast
+        cpx #J65_SKIP
+        beq start_skipping
+        cpx #J65_YIELD
+        beq yield
         txa
         asl                     ; set carry if return value is negative
         txa                     ; get return value back into a
         rts                     ; end of subroutine
+
+
+start_skipping:
+        getstate st::stack_idx
+        ldx evtype
+        cpx #J65_KEY
+        beq skip_value
+        cpx #J65_START_OBJ
+        beq skip_this
+        cpx #J65_START_ARRAY
+        bne no_skip             ; J65_SKIP means nothing for other events
+skip_this:
+        add #1
+skip_value:                     ; skip the value following the key, which
+        putstate st::skip_idx   ; is one level deeper if it is an array/obj
+        lda #1
+        putstate st::skip_on
+no_skip:
+        jmp suppress
+
+yield:  getstate st::options    ; stop after this char, as ring_event
+        ora #opt_paused | opt_yield ; does when the ring is full
+        sta (state),y
+        lda charidx             ; make this the last char of the chunk
+        sta inbuflast
+        jmp suppress
 .endproc                ; call_callback
 
+;; call_callback comes here in ring mode, with the ring in ptr1.
+;; appends a record for the event to the ring.  if there isn't room,
+;; the event is kept in pending, and parse is made to stop as soon as
+;; it is done with the current char.
+;; returns 0 with carry clear.  clobbers all regs.
+.proc ring_event
+        ldx str_idx
+        jsr append_record
+        bcc done
+        lda evtype              ; keep the event for write_pending
+        ora #$80
+        putstate pending
+        getstate st::options
+        ora #opt_paused
+        sta (state),y
+        lda charidx             ; make this the last char of the chunk
+        sta inbuflast
+done:   lda #0
+        clc
+        rts
+.endproc                ; ring_event
+
+;; called by j65_parse when there is an event in pending, which did
+;; not fit in the ring last time.
+;; returns J65_RING_FULL in x if it still doesn't fit, J65_DONE if
+;; it was the last event of the JSON value, or J65_WANT_MORE otherwise.
+;; clobbers all other regs.
+.proc write_pending
+        and #$7f
+        sta evtype
+        ldy #st::callback       ; get ring into ptr1
+        lda (state),y
+        sta ptr1
+        iny
+        lda (state),y
+        sta ptr1+1
+        getstate st::str_idx
+        tax
+        jsr append_record
+        ldx #J65_RING_FULL
+        bcs done
+        lda #0
+        putstate pending
+        ldx #J65_WANT_MORE
+        getstate st::parser_st
+        cmp #par_done
+        bne done
+        ldx #J65_DONE
+done:   rts
+.endproc                ; write_pending
+
+;; appends a record for the event in evtype to the ring (in ptr1).
+;; a record is the event type, the length of the string (passed in x),
+;; the integer (4 bytes, only for J65_INTEGER), the string (only for
+;; events which have one), and a NUL.
+;; returns carry set if there isn't room.
+;; clobbers all regs, ptr2, tmp1, and regsave.
+.proc append_record
+        lda evtype              ; does this event have a string?
+        cmp #J65_INTEGER
+        blt nostring
+        cmp #J65_KEY+1
+        blt string
+        cmp #J65_STRING_PART
+        bge string
+nostring:
+        ldx #0
+string: stx tmp1                ; length of string
+        lda #3                  ; length of record is 3 + string length
+        ldy evtype
+        cpy #J65_INTEGER
+        bne noint
+        lda #3 + 4              ; (plus 4 for the integer)
+noint:  add tmp1
+        sta regsave
+        lda #0
+        adc #0
+        sta regsave+1
+        jsr ring_room
+        bcs full
+        ldy #0
+        lda evtype
+        sta (ptr2),y
+        iny
+        lda tmp1
+        sta (ptr2),y
+        iny
+        lda evtype
+        cmp #J65_INTEGER
+        bne header_done
+        .repeat 4, i
+        ldy #st::long_val+i
+        lda (state),y
+        ldy #2+i
+        sta (ptr2),y
+        .endrep
+        iny
+header_done:                    ; y is length of header; skip over it
+        tya
+        add ptr2
+        sta ptr2
+        bcc copy
+        inc ptr2+1
+copy:   ldy #0
+loop:   cpy tmp1
+        beq terminate
+        lda (strbuf),y
+        sta (ptr2),y
+        iny
+        bne loop                ; always taken
+terminate:
+        lda #0
+        sta (ptr2),y            ; null-terminate string
+        ldy #ring::head         ; now the record is in the ring
+        lda regsave+2
+        sta (ptr1),y
+        iny
+        lda regsave+3
+        sta (ptr1),y
+        clc
+full:   rts
+.endproc                ; append_record
+
+;; finds room in the ring (in ptr1) for a record, whose length is in
+;; regsave.  the ring is full if the head would catch up with the tail
+;; (since that means empty).  a record is never split across the end
+;; of the ring; if it doesn't fit at the end, a ring_wrap byte is
+;; written there, and the record goes at the start instead.
+;; a ring which is empty is first moved back to the start.
+;; on success, returns carry clear, with the address to write the
+;; record at in ptr2, and the new head in regsave+2.  (nothing is
+;; changed in the ring itself, except maybe the ring_wrap byte, which
+;; is past the head.)
+;; if there isn't room, returns carry set.
+;; clobbers all regs.
+.proc ring_room
+        ldy #ring::head
+        lda (ptr1),y
+        sta ptr2
+        iny
+        lda (ptr1),y
+        sta ptr2+1
+        ldy #ring::tail         ; if the ring is empty, move the head
+        lda ptr2                ; and tail back to the start, so there
+        cmp (ptr1),y            ; is as much room as possible
+        bne notempty
+        iny
+        lda ptr2+1
+        cmp (ptr1),y
+        bne notempty
+        lda #0
+        sta ptr2
+        sta ptr2+1
+        ldy #ring::head
+        ldx #4
+clear:  sta (ptr1),y            ; head and tail
+        iny
+        dex
+        bne clear
+notempty:
+        lda ptr2                ; end of record is head + length
+        add regsave
+        sta regsave+2
+        lda ptr2+1
+        adc regsave+1
+        sta regsave+3
+        ldy #ring::tail
+        lda ptr2
+        cmp (ptr1),y
+        iny
+        lda ptr2+1
+        sbc (ptr1),y
+        bcc before_tail         ; head < tail
+        ldy #ring::size         ; head >= tail, so the free space is from
+        lda (ptr1),y            ; the head to the end of the ring (and
+        sub regsave+2           ; then from the start up to the tail)
+        tax
+        iny
+        lda (ptr1),y
+        sbc regsave+3
+        bcc wrap                ; record would go past the end
+        bne fits                ; record ends before the end
+        txa
+        bne fits
+        ldy #ring::tail         ; record ends at the end, so the head
+        lda (ptr1),y            ; would go back to 0 (which is only okay
+        iny                     ; if the tail isn't there)
+        ora (ptr1),y
+        beq full
+        lda #0
+        sta regsave+2
+        sta regsave+3
+        beq fits                ; always taken
+wrap:   ldy #ring::tail         ; is there room at the start?  the
+        lda regsave             ; record has to end before the tail.
+        cmp (ptr1),y
+        iny
+        lda regsave+1
+        sbc (ptr1),y
+        bcs full
+        jsr add_buf             ; mark the end of the data
+        lda #ring_wrap
+        ldy #0
+        sta (ptr2),y
+        sty ptr2                ; and put the record at the start
+        sty ptr2+1
+        lda regsave
+        sta regsave+2
+        lda regsave+1
+        sta regsave+3
+        jra fits
+before_tail:                    ; head < tail, so the record has to end
+        ldy #ring::tail         ; before the tail
+        lda regsave+2
+        cmp (ptr1),y
+        iny
+        lda regsave+3
+        sbc (ptr1),y
+        bcs full
+fits:   jsr add_buf
+        clc
+        rts
+full:   sec
+        rts
+
+add_buf:                        ; turn ptr2 from an index into an address
+        ldy #ring::buf
+        lda (ptr1),y
+        add ptr2
+        sta ptr2
+        iny
+        lda (ptr1),y
+        adc ptr2+1
+        sta ptr2+1
+        rts
+.endproc                ; ring_room
+
+.ifndef J65_NO_POSITIONS
 ;; add charidx plus carry flag to file_off and store result in regsave.
-;; clobbers a, x, y.
+;; clobbers a and y.  preserves x.
 .proc make_byte_offset
         lda charidx
         ldy #st::file_off
@@ -855,6 +2470,32 @@ literal_errors:                 ; needs to match parser state enum
         rts
 .endproc                ; make_byte_offset
 
+;; sets zero flag if file_off plus charidx is equal to line_off.
+;; (in other words, if nothing has been consumed since the last
+;; line ending.)
+;; clobbers a and y.  preserves x.
+.proc at_line_start
+        clc
+        jsr make_byte_offset
+        ldy #st::line_off
+        lda regsave
+        cmp (state),y
+        bne done
+        iny
+        lda regsave+1
+        cmp (state),y
+        bne done
+        iny
+        lda regsave+2
+        cmp (state),y
+        bne done
+        iny
+        lda regsave+3
+        cmp (state),y
+done:   rts
+.endproc                ; at_line_start
+.endif
+
 ;; Takes escape code in esc_code (tmp2).
 ;; If legal, returns escaped char in a with carry clear.
 ;; If not legal, returns with carry set.
@@ -876,31 +2517,73 @@ notfound:
 
         .rodata
 escape_codes:
-        .byte $22,"/bfnrt",0
+        .byte $22,$5c,"/bfnrt",0
 escaped_chars:
-        .byte $22, $2f, $08, $0c, $0a, $0d, $09
+        .byte $22, $5c, $2f, $08, $0c, $0a, $0d, $09
         .code
 
 .endproc                ; lookup_escape
 
+;; after an error in J65_RECOVER mode, switches to lex_recover, which
+;; skips the rest of the bad record.  str_idx counts the nesting depth
+;; while skipping, and in flags, the high bit means "in a string" and
+;; bit 6 means "after a backslash."  the char where the error happened
+;; is looked at again by lex_recover, since it might be the newline
+;; which ends the record.
+;; clobbers a, x, and y.
+.proc start_recovery
+        ldx #0
+        lda lexer_st
+        cmp #lex_string
+        blt not_string
+        ldx #$80                ; the error was in a string
+not_string:
+        stx flags
+        getstate st::stack_idx
+        eor #$ff                ; current depth
+        sta str_idx
+        lda #lex_recover
+        sta lexer_st
+        lda #par_ready          ; anything but par_done (see nextchar)
+        sta parser_st
+        rts
+.endproc                ; start_recovery
+
+;; in lex_str_borrow, copies the string so far (from str_idx up to, but
+;; not including, the index in a) from inbuf to strbuf, and switches to
+;; lex_string.
+;; clobbers all registers and ptr1.
+.proc spill_view
+        sub str_idx
+        tax                     ; length
+        lda str_idx             ; point ptr1 at the string in inbuf
+        add inbuf
+        sta ptr1
+        lda inbuf+1
+        adc #0
+        sta ptr1+1
+        stx str_idx
+        ldy #0
+loop:   cpy str_idx
+        beq done
+        lda (ptr1),y
+        sta (strbuf),y
+        iny
+        bne loop                ; always taken
+done:   lda #lex_string
+        sta lexer_st
+        rts
+.endproc                ; spill_view
+
 ;; Handle a double-quoted string.
-;; Check flags to see if it needs a second unescaping pass.
 ;; Clobbers all registers.
 ;; On success, returns carry clear.
 ;; On error, returns carry set with error event in a.
 .proc handle_string
-        getstate st::flags
-        beq skipescape
-        jsr unescape_unicode
-        bcc skipescape
-        lda #J65_ILLEGAL_ESCAPE
-        rts                     ; error exit; carry is still set
-skipescape:
-        getstate st::str_idx
-        tay
+        ldy str_idx
         lda #0
         sta (strbuf),y          ; null-terminate string
-        getstate st::parser_st
+        lda parser_st
         cmp #par_ready
         beq p_ready
         cmp #par_ready_or_close_array
@@ -918,7 +2601,7 @@ p_ready:
         jsr call_callback
         bcs error
         getstate st::parser_st2 ; get next parser state in a
-        putstate st::parser_st
+        sta parser_st
         clc
         rts                     ; success exit
 p_key:  lda #J65_KEY
@@ -926,131 +2609,102 @@ p_key:  lda #J65_KEY
         jsr call_callback
         bcs error
         lda #par_need_colon
-        putstate st::parser_st
+        sta parser_st
         clc
         rts                     ; success exit
 .endproc                ; handle_string
 
-;; unescape \\ and \u in the string buffer.
-;; returns carry set on error.  clear on success.
-;; clobbers all registers.
-.proc unescape_unicode
-        getstate st::str_idx
-        sta tmp2
-        ldy #0
-        sty tmp1
-loop:   cpy tmp2
-        beq done
-        lda (strbuf),y
-        iny
-        cmp #$5c                ; backslash
-        beq escape
-loop1:  sty tmp5
-        ldy tmp1
-        sta (strbuf),y
-        inc tmp1
-        ldy tmp5
-        jmp loop
-escape: cpy tmp2
-        beq error
-        lda (strbuf),y
-        iny
-        cmp #$5c                ; backslash
-        beq loop1
-        cmp #'u'
-        beq unicode
-error:  sec
-        rts
-unicode:
-        jsr read4hexintosreg
-        bcs error
-        jsr movesregtolong1
-        lda (strbuf),y
-        cpy tmp2
-        beq bmp
-        cmp #$5c                ; backslash
-        bne bmp
-        iny
-        cpy tmp2
-        beq bmp0
-        lda (strbuf),y
-        cmp #'u'
-        beq check_surrogate
-bmp0:   dey
-bmp:    jsr long1toutf8
-        jmp loop
-bmp1:   pla
-        tay
-        jmp bmp
-check_surrogate:
-        jsr is_sreg_left_surrogate
-        bcc bmp0
-        tya
-        sub #1
-        pha
+;; called when there is no room in strbuf for the next char.
+;; If J65_STREAM_STRINGS is on (or we are validating), and we are in a
+;; string (not a literal), flushes strbuf with flush_string_part.
+;; Otherwise, the string is too long.  (when validating, strbuf only
+;; gets escapes, and flush_string_part just empties it, since there is
+;; no callback.)
+;; In ring mode, the ring must have room for the part first.  If it
+;; doesn't, returns J65_RING_FULL, and the current char is parsed
+;; again next time.  (By then, the ring will have been drained.)
+;; On success, returns carry clear.
+;; On error, returns carry set with error event in a.
+;; Clobbers all registers.
+.proc make_room
+        getstate st::options
+        tax
+        lda lexer_st
+        cmp #lex_string
+        blt toolong             ; not in a string
+        txa
+        and #opt_validate
+        cmp #opt_validate
+        beq flush_string_part   ; tail call
+        txa
+        and #J65_STREAM_STRINGS
+        beq toolong
+        txa
+        and #opt_ring
+        beq flush_string_part   ; tail call
+        ldy #st::callback       ; get ring into ptr1
+        lda (state),y
+        sta ptr1
         iny
-        jsr read4hexintosreg
-        bcs bmp1
-        jsr is_sreg_right_surrogate
-        bcc bmp1
-        pla
-        jsr combine_surrogates
-        jmp bmp
-done:   lda tmp1
-        putstate st::str_idx
-        clc
-        rts
-.endproc                ; unescape_unicode
+        lda (state),y
+        sta ptr1+1
+        lda #<ring_max_record   ; room for any record, so a part
+        sta regsave             ; can never be kept out for good
+        lda #>ring_max_record
+        sta regsave+1
+        jsr ring_room
+        bcc flush_string_part   ; tail call
+        lda #J65_RING_FULL
+        rts                     ; stop; carry is still set
+toolong:
+        lda #J65_STRING_TOO_LONG
+        sec
+        rts                     ; error exit
+.endproc                ; make_room
 
-;; reads 4 hex digs from strbuf at y into sreg.
-;; (buffer length is in tmp2)
-;; on success, carry clear, leaves y pointing after 4 digs.
-;; on failure, carry set.
-.proc read4hexintosreg
-        ldx #4
-loop:   jsr shift_sreg_left_4bits
-        jsr or1hexintosreg
-        bcs done
-        dex
-        bne loop
-        clc
-done:   rts
-.endproc                ; read4hexintosreg
+;; delivers what is in strbuf as a J65_STRING_PART or J65_KEY_PART
+;; event, and then empties strbuf.  (escapes are decoded as they are
+;; lexed, so there is never a partial one to hold back.)
+;; On success, returns carry clear.
+;; On error, returns carry set with error event in a.
+;; Clobbers all registers.
+.proc flush_string_part
+        ldy str_idx
+        lda #0
+        sta (strbuf),y          ; null-terminate string
+        ldx #J65_STRING_PART
+        lda parser_st
+        cmp #par_key
+        beq key
+        cmp #par_key_or_close_object
+        bne notkey
+key:    ldx #J65_KEY_PART
+notkey: stx evtype
+        jsr call_callback
+        bcs error
+        lda #0
+        sta str_idx
+error:  rts
+.endproc                ; flush_string_part
 
+.ifndef J65_NO_UNICODE_ESCAPES
 ;; clobbers a, preserves x and y.
 .proc shift_sreg_left_4bits
         lda sreg
         asl a
         rol sreg+1
         asl a
-        rol sreg+1
-        asl a
-        rol sreg+1
-        asl a
-        rol sreg+1
-        sta sreg
-        rts
-.endproc                ; shift_sreg_left_4bits
-
-;; reads 1 hex dig from strbuf at y into low 4 bits of sreg.
-;; (buffer length is in tmp2)
-;; on success, carry clear, leaves y pointing after digit.
-;; on failure, carry set.
-.proc or1hexintosreg
-        cpy tmp2
-        beq fail
-        lda (strbuf),y
-        iny
-        jsr hex_dig_to_nibble
-        bcs fail
-        ora sreg
+        rol sreg+1
+        asl a
+        rol sreg+1
+        asl a
+        rol sreg+1
         sta sreg
-        clc
-        rts
-fail:   sec
         rts
-.endproc                ; and1hexintosreg
+.endproc                ; shift_sreg_left_4bits
+.endif
 
+.if int_bits = 32 || !.defined(J65_NO_UNICODE_ESCAPES)
 ;; converts ascii char in a to nibble in a.
 ;; sets carry if not a hex digit.
 ;; preserves x and y.
@@ -1081,20 +2735,9 @@ trylower:
 fail:   sec
         rts
 .endproc                ; hex_dig_to_nibble
+.endif
 
-;; zero-extends sreg into long1.
-;; clobbers a, preserves x and y
-.proc movesregtolong1
-        lda sreg
-        sta long1
-        lda sreg+1
-        sta long1+1
-        lda #0
-        sta long1+2
-        sta long1+3
-        rts
-.endproc                ; movesregtolong1
-
+.ifndef J65_NO_UNICODE_ESCAPES
 ;; converts long1 to utf8 in strbuf at tmp1.
 ;; (output index is in tmp1)
 ;; preserves y.
@@ -1118,7 +2761,7 @@ len2:   ldx #1
         ora #%11000000
         sta long1+1
         ldx #1
-        jmp done
+        jra done
 len3:   ldx #1
         jsr utf8_shift
         ldx #2
@@ -1136,7 +2779,7 @@ len3:   ldx #1
         ora #%11100000
         sta long1+2
         ldx #2
-        jmp done
+        jra done
 len4:   ldx #1
         jsr utf8_shift
         ldx #2
@@ -1160,7 +2803,7 @@ len4:   ldx #1
         ora #%11110000
         sta long1+3
         ldx #3
-        jmp done
+        jra done
 latin1: lda long1
         bmi len2
         ldx #0                  ; length 1, already in the right format
@@ -1170,6 +2813,65 @@ done:   jsr writeutf8
         rts
 .endproc                ; long1toutf8
 
+;; appends long1 to strbuf as utf-8, if there is room for it.
+;; on success, returns carry clear.  if there isn't room, returns
+;; carry set, and leaves strbuf alone.
+;; clobbers all registers.
+.proc put_utf8
+        ldx #3                  ; length - 1
+        lda long1+2
+        bne check
+        dex
+        lda long1+1
+        cmp #8
+        bge check
+        dex
+        cmp #0
+        bne check
+        lda long1
+        bmi check
+        dex
+check:  txa
+        add str_idx             ; full if str_idx + length - 1 >= str_max
+        bcs full
+        ldy #st::str_max
+        cmp (state),y
+        bcs full
+        lda str_idx
+        sta tmp1
+        jsr long1toutf8
+        lda tmp1
+        sta str_idx
+        clc
+full:   rts
+.endproc                ; put_utf8
+
+;; puts the left surrogate in long_val+2 into strbuf by itself, since
+;; it is not followed by a right surrogate, and forgets about it.
+;; On success, returns carry clear.
+;; On error, returns carry set with error event in a.
+;; Clobbers all registers.
+.proc put_surrogate
+retry:  ldy #st::long_val+2
+        lda (state),y
+        sta long1
+        iny
+        lda (state),y
+        sta long1+1
+        lda #0
+        sta long1+2
+        sta long1+3
+        jsr put_utf8
+        bcc done
+        jsr make_room
+        bcc retry
+        rts                     ; error exit
+done:   lda flags
+        and #$7f
+        sta flags
+        rts                     ; carry is still clear
+.endproc                ; put_surrogate
+
 ;; writes the first x+1 bytes of long1, in reverse order,
 ;; to strbuf, starting at y.  advances y.
 ;; clobbers a, x.
@@ -1196,7 +2898,7 @@ loop:   php
         inx
         plp
         rol long1,x
-        jmp loop
+        jra loop
 done:   plp
         rts
 .endproc                ; shift_left_by_2
@@ -1216,32 +2918,6 @@ done:   plp
         rts
 .endproc                ; fancy_shift
 
-;; preserves y.
-;; sets carry if sreg is a left surrogate.
-.proc is_sreg_left_surrogate
-        lda sreg+1
-        and #$fc
-        cmp #$d8
-        beq yes
-        clc
-        rts
-yes:    sec
-        rts
-.endproc                ; is_sreg_left_surrogate
-
-;; preserves y.
-;; sets carry if sreg is a right surrogate.
-.proc is_sreg_right_surrogate
-        lda sreg+1
-        and #$fc
-        cmp #$dc
-        beq yes
-        clc
-        rts
-yes:    sec
-        rts
-.endproc                ; is_sreg_right_surrogate
-
 ;; combine left surrogate in long1 with right surrogate in sreg.
 ;; result in long1.  preserves y.
 .proc combine_surrogates
@@ -1263,7 +2939,9 @@ yes:    sec
         inc long1+2
         rts
 .endproc
+.endif                          ; J65_NO_UNICODE_ESCAPES
 
+.if int_bits = 32
 ;; parse signed integer in strbuf (length in str_idx).
 ;; on success, carry clear and result in long1 (regsave).
 ;; on integer overflow, carry set and overflow set.
@@ -1299,9 +2977,84 @@ okay:   jsr resteax
         jsr negeax
         jsr saveeax
         clc
-        jmp done
+        jra done
 .endproc                ; parse_signed_integer
+.endif
+
+;; long1 (regsave) is the magnitude of an integer accumulated by
+;; l_int, and strbuf is its digits.  if the first char is a minus sign,
+;; negates long1.
+;; on success, carry clear and result in long1.
+;; if the integer doesn't fit in a signed long, carry set.
+;; (with J65_INT16, only the low 2 bytes of long1 are accumulated, and
+;; the result has to fit in a signed int.  it is sign-extended to 32
+;; bits, for j65_get_integer.)
+;; clobbers a, x, and y.
+.if int_bits = 32
+.proc apply_sign
+        ldy #0
+        lda (strbuf),y
+        cmp #'-'
+        beq negative
+        lda long1+3             ; positive: hi bit must be clear
+        asl
+        rts
+negative:
+        lda long1+3
+        bpl okay                ; if hi bit is clear, it is okay
+        cmp #$80
+        bne not_okay            ; if hi byte is not $80, it is not okay
+        lda long1+2
+        ora long1+1
+        ora long1
+        bne not_okay            ; only okay if 3 least significant bytes are 0
+okay:   jsr resteax
+        jsr negeax
+        jsr saveeax
+        clc
+        rts
+not_okay:
+        sec
+        rts
+.endproc                ; apply_sign
+.elseif int_bits = 16
+.proc apply_sign
+        ldy #0
+        lda (strbuf),y
+        cmp #'-'
+        beq negative
+        lda long1+1             ; positive: hi bit must be clear
+        bmi not_okay
+        bpl extend              ; always taken
+negative:
+        lda long1+1
+        bpl okay                ; if hi bit is clear, it is okay
+        cmp #$80
+        bne not_okay            ; if hi byte is not $80, it is not okay
+        lda long1
+        bne not_okay            ; only okay if lo byte is 0
+okay:   lda #0                  ; negate
+        sub long1
+        sta long1
+        lda #0
+        sbc long1+1
+        sta long1+1
+extend: ldx #0
+        lda long1+1
+        bpl positive
+        dex
+positive:
+        stx long1+2
+        stx long1+3
+        clc
+        rts
+not_okay:
+        sec
+        rts
+.endproc                ; apply_sign
+.endif
 
+.if int_bits = 32
 ;; parse unsigned integer in strbuf, starting at y.
 ;; on success, carry clear and result in long1 (regsave).
 ;; on integer overflow, carry set and overflow set.
@@ -1313,11 +3066,8 @@ okay:   jsr resteax
         sta long1+1
         sta long1+2
         sta long1+3
-loop:   tya
-        ldy #st::str_idx
-        cmp (state),y
+loop:   cpy str_idx
         bge done
-        tay
         jsr multiply_long1_by_10
         bcs overflow
         lda (strbuf),y
@@ -1393,80 +3143,17 @@ done:   rts
         sta long1+3
         rts
 .endproc                ; add_a_to_long1
-
-;; parse "null", "false", or "true" in strbuf (length in str_idx).
-;; on success, carry clear and a contains event number.
-;; on failure, carry set.  clobbers x and y.
-.proc identify_literal
-        getstate st::str_idx
-        cmp #4
-        beq len4
-        cmp #5
-        beq len5
-fail:   sec
-        rts
-len4:   lda #<str_null
-        ldx #>str_null
-        ldy #3
-        jsr compare_strings
-        beq got_null
-        lda #<str_true
-        ldx #>str_true
-        ldy #3
-        jsr compare_strings
-        bne fail
-        lda #J65_TRUE
-        clc
-        rts
-got_null:
-        lda #J65_NULL
-        clc
-        rts
-len5:   lda #<str_false
-        ldx #>str_false
-        ldy #4
-        jsr compare_strings
-        bne fail
-        lda #J65_FALSE
-        clc
-        rts
-
-        .rodata
-str_null:
-        .byte "null"
-str_true:
-        .byte "true"
-str_false:
-        .byte "false"
-        .code
-
-.endproc                ; identify_literal
-
-;; compares string (of length y+1) at strbuf with string pointed to
-;; by a (lo byte) and x (hi byte).
-;; returns with zero flag set if strings match, or zero flag clear
-;; if they do not.
-;; clobbers ptr1.
-.proc compare_strings
-        sta ptr1
-        stx ptr1+1
-loop:   lda (strbuf),y
-        cmp (ptr1),y
-        bne done
-        dey
-        bpl loop
-        lda #0                  ; set zero flag
-done:   rts
-.endproc                    ; compare_strings
+.endif
 
 ;; Handle a literal (a number, or null, true, or false).
-;; On entry, a should contain flags.  (prop_lit, prop_int, prop_num)
+;; On entry, a should contain flags.  (prop_lit, prop_int, prop_num,
+;; plus the event number, for a keyword recognized by l_keyword)
 ;; Clobbers all registers.
 ;; On success, returns carry clear.
 ;; On error, returns carry set with error event in a.
 .proc handle_literal
         tax
-        getstate st::parser_st
+        lda parser_st
         cmp #par_ready
         beq p_ready
         cmp #par_ready_or_close_array
@@ -1487,12 +3174,43 @@ do_callback:
         jsr call_callback
         bcs error
         getstate st::parser_st2 ; get next parser state in a
-        putstate st::parser_st
+        sta parser_st
         clc
         rts                     ; success exit
+.if int_bits = 0
+integer:
+.endif
+check_minus:                    ; only digits and minus signs.  a minus
+        ldy str_idx             ; sign after the start is a parse error;
+scan:   dey                     ; otherwise, it is a J65_NUMBER
+        beq number
+        lda (strbuf),y
+        cmp #'-'
+        bne scan
+        beq parse_err           ; always taken
+.if int_bits > 0
 integer:
+        lda lexer_st            ; was it accumulated as it came in?
+        cmp #lex_int
+.if int_bits = 32
+        bne rescan
+.else
+        bne check_minus
+.endif
+        jsr apply_sign
+        bcs number              ; out of range
+        bcc have_integer        ; always taken
+.endif
+.if int_bits = 32
+rescan: getstate st::options    ; when validating, the value isn't needed
+        and #opt_validate
+        cmp #opt_validate
+        beq check_minus
         jsr parse_signed_integer
         bcs not_integer
+.endif
+.if int_bits > 0
+have_integer:
         ldy #st::long_val       ; copy long1 to long_val
         lda long1
         sta (state),y
@@ -1506,14 +3224,19 @@ integer:
         lda long1+3
         sta (state),y
         lda #J65_INTEGER
-        jmp do_callback
+        jra do_callback
+.if int_bits = 32
 not_integer:
         bvs number
-        jmp parse_err
+        jra parse_err
+.endif
+.endif                          ; int_bits > 0
 keyword:
-        jsr identify_literal
-        bcs parse_err
-        jmp do_callback
+        ldy lexer_st            ; only l_keyword can come up with null,
+        cpy #lex_keyword        ; true, or false
+        bne parse_err
+        and #%00000111          ; event number, from flags
+        jra do_callback
 
         .rodata
 flags_prop_lit:
@@ -1524,22 +3247,32 @@ flags_prop_int:
 
 .endproc                ; handle_literal
 
-;; push a onto the state stack.
+;; push a (the parser_st2 of the enclosing value) onto the state stack.
+;; only one bit is kept: set for par_need_comma_or_close_object, and
+;; clear for par_need_comma_or_close_array.  par_done is only pushed
+;; at the top level, so pop_state_stack can tell it from the depth.
 ;; carry clear on success.
 ;; carry set on error, with error event in a.
-;; clobbers x, y.
+;; clobbers x, y, and tmp1.
 .proc push_state_stack
-        tax
+        sta tmp1
         getstate st::stack_idx
         ldy #st::stack_min
         cmp (state),y
         blt stack_full
-        tay
-        txa
-        sta (state),y
-        dey
-        tya
+        sub #1
         putstate st::stack_idx
+        jsr find_stack_bit
+        ldx tmp1
+        cpx #par_need_comma_or_close_object
+        beq object
+        eor #$ff
+        and (state),y
+        sta (state),y
+        clc
+        rts
+object: ora (state),y
+        sta (state),y
         clc
         rts
 stack_full:
@@ -1551,17 +3284,28 @@ stack_full:
 ;; pop the state stack.
 ;; carry clear on success, with popped state in a.
 ;; carry set on error, with error event in a.
-;; clobbers x, y.
+;; clobbers x, y, and tmp1.
 .proc pop_state_stack
         getstate st::stack_idx
-        tay
-        iny
+        cmp #$ff
         beq stack_empty
-        lda (state),y
-        tax
-        tya
-        putstate st::stack_idx
-        txa
+        jsr find_stack_bit
+        and (state),y
+        sta tmp1                ; nonzero for an object
+        getstate st::stack_idx
+        add #1
+        sta (state),y
+        cmp #$ff
+        beq top                 ; back at the top level
+        lda tmp1
+        beq array
+        lda #par_need_comma_or_close_object
+        clc
+        rts
+array:  lda #par_need_comma_or_close_array
+        clc
+        rts
+top:    lda #par_done
         clc
         rts
 stack_empty:
@@ -1570,6 +3314,31 @@ stack_empty:
         rts
 .endproc                ; pop_state_stack
 
+;; finds the bit for stack index a in the packed depth stack.  (the
+;; bits are numbered by depth, from 1 up to max_depth.)
+;; returns its offset in the state in y, and its mask in a.
+;; clobbers x.
+.proc find_stack_bit
+        eor #$ff                ; depth, so max_depth says how many bytes
+        tax
+        lsr
+        lsr
+        lsr
+        add #stack_bits
+        tay
+        txa
+        and #7
+        tax
+        lda bit_masks,x
+        rts
+
+        .rodata
+bit_masks:
+        .byte $01, $02, $04, $08, $10, $20, $40, $80
+        .code
+.endproc                ; find_stack_bit
+
+.ifndef J65_NO_POSITIONS
 ;; increment the long at state+y to state+y+3 by 1.
 ;; clobbers a and y.
 .proc inc_state_long
@@ -1591,19 +3360,101 @@ stack_empty:
         sta (state),y
 done:   rts
 .endproc                ; inc_state_long
+.endif
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;;                          j65_get_string                          ;;
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 
 ;; const char * __fastcall__ j65_get_string(const j65_state *s);
-;; (string buffer is the second 256 bytes of state, so all we have
-;; to do is increment the high byte of the argument)
+;; (usually all we have to do is return strbuf.  a borrowed string is
+;; copied there first, so that it can be NUL-terminated.)
 .proc _j65_get_string
-        inx
+        sta ptr1
+        stx ptr1+1
+        ldy #st::lexer_st
+        lda (ptr1),y
+        cmp #lex_str_borrow
+        beq borrowed
+        ldy #st::strbuf+1
+        lda (ptr1),y
+        tax
+        dey
+        lda (ptr1),y
+        rts
+borrowed:
+        ldy #st::long_val
+        lda (ptr1),y
+        sta ptr2
+        iny
+        lda (ptr1),y
+        sta ptr2+1
+        ldy #st::str_idx
+        lda (ptr1),y
+        sta tmp1                ; length
+        ldy #st::strbuf         ; point ptr1 at string buffer
+        lda (ptr1),y
+        tax
+        iny
+        lda (ptr1),y
+        sta ptr1+1
+        stx ptr1
+        ldy #0
+loop:   cpy tmp1
+        beq done
+        lda (ptr2),y
+        sta (ptr1),y
+        iny
+        bne loop                ; always taken
+done:   lda #0
+        sta (ptr1),y            ; null-terminate string
+        lda ptr1
+        ldx ptr1+1
         rts
 .endproc                ; _j65_get_string
 
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;                           j65_get_view                           ;;
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+
+;; const char * __fastcall__ j65_get_view(const j65_state *s);
+;; (a borrowed string's address in inbuf is kept in long_val)
+.proc _j65_get_view
+        sta ptr1
+        stx ptr1+1
+        ldy #st::lexer_st
+        lda (ptr1),y
+        ldy #st::strbuf+1
+        cmp #lex_str_borrow
+        bne get_ptr
+        ldy #st::long_val+1
+get_ptr:
+        lda (ptr1),y
+        tax
+        dey
+        lda (ptr1),y
+        rts
+.endproc                ; _j65_get_view
+
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;                         j65_is_borrowed                          ;;
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+
+;; uint8_t __fastcall__ j65_is_borrowed(const j65_state *s);
+.proc _j65_is_borrowed
+        sta ptr1
+        stx ptr1+1
+        ldx #0
+        ldy #st::lexer_st
+        lda (ptr1),y
+        cmp #lex_str_borrow
+        beq yes
+        txa
+        rts
+yes:    lda #1
+        rts
+.endproc                ; _j65_is_borrowed
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ;;                          j65_get_length                          ;;
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
@@ -1649,7 +3500,7 @@ get_long:
 ;; uint32_t __fastcall__ j65_get_line_offset(const j65_state *s);
 .proc _j65_get_line_offset
         ldy #st::line_off+3
-        jmp get_long
+        jra get_long
 .endproc                ; _j65_get_line_offset
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
@@ -1659,7 +3510,7 @@ get_long:
 ;; uint32_t __fastcall__ j65_get_line_number(const j65_state *s);
 .proc _j65_get_line_number
         ldy #st::line_num+3
-        jmp get_long
+        jra get_long
 .endproc                ; _j65_get_line_number
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
@@ -1667,9 +3518,46 @@ get_long:
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 
 ;; uint32_t __fastcall__ j65_get_column_number(const j65_state *s);
+;; (the column is not counted while parsing; it is worked out from
+;; file_off, cur_idx, and line_off only when someone asks for it)
 .proc _j65_get_column_number
-        ldy #st::col_num+3
-        jmp get_long
+        sta ptr1
+        stx ptr1+1
+        ldy #st::cur_idx        ; file_off + cur_idx is the current position
+        lda (ptr1),y
+        ldy #st::file_off
+        add (ptr1),y
+        sta regsave
+        iny
+        lda (ptr1),y
+        adc #0
+        sta regsave+1
+        iny
+        lda (ptr1),y
+        adc #0
+        sta regsave+2
+        iny
+        lda (ptr1),y
+        adc #0
+        sta regsave+3
+        ldy #st::line_off       ; subtract line_off to get the column
+        lda regsave
+        sub (ptr1),y
+        sta regsave
+        iny
+        lda regsave+1
+        sbc (ptr1),y
+        tax
+        iny
+        lda regsave+2
+        sbc (ptr1),y
+        sta sreg
+        iny
+        lda regsave+3
+        sbc (ptr1),y
+        sta sreg+1
+        lda regsave
+        rts
 .endproc                ; _j65_get_column_number
 
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
@@ -1717,3 +3605,25 @@ get_long:
         lda (ptr1),y
         rts
 .endproc                ; _j65_get_context
+
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;                         j65_get_consumed                         ;;
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+
+;; size_t __fastcall__ j65_get_consumed(const j65_state *s);
+.proc _j65_get_consumed
+        sta ptr1
+        stx ptr1+1
+        ldy #st::file_off       ; how far file_off has moved since
+        lda (ptr1),y            ; j65_parse was called
+        ldy #st::start_off
+        sub (ptr1),y
+        sta tmp1
+        ldy #st::file_off+1
+        lda (ptr1),y
+        ldy #st::start_off+1
+        sbc (ptr1),y
+        tax
+        lda tmp1
+        rts
+.endproc                ; _j65_get_consumed
@@ -31,14 +31,24 @@ static j65_parser parser;
 static j65_tree tree;
 static const char infile[] = "test-tree.json";
 
-static int do_test (size_t len) {
+/* test-tree.json has 37 nodes, so split them between two arenas */
+static j65_node arena_nodes1[10];
+static j65_node arena_nodes2[40];
+static j65_arena arena1, arena2;
+
+static int do_test (size_t len, j65_arena *arena, uint8_t locations) {
     int8_t status;
     j65_node *n;
     uint8_t node_type;
     const char *str;
+    j65_source_location loc;
     uint32_t line_number, column_number;
 
-    j65_init_tree (&tree);
+    if (arena != NULL)
+        j65_init_tree_arena (&tree, arena);
+    else
+        j65_init_tree (&tree);
+    j65_set_tree_locations (&tree, locations);
     j65_init (&parser, &tree, j65_tree_callback, 255);
     status = j65_parse (&parser, buf, len);
     if (status != J65_DONE) {
@@ -72,26 +82,89 @@ static int do_test (size_t len) {
         return 1;
     }
 
-    line_number = n->location.line_number + 1;
-    column_number = n->location.column_number;
-    if (line_number != 8) {
-        fprintf (stderr, "line number %lu != 8\n", line_number);
+    if (locations == J65_LOCATIONS_OFFSET)
+        j65_find_location (buf, n->offset, &loc);
+    else if (locations == J65_LOCATIONS_FULL)
+        loc = n->location;
+
+    if (locations != J65_LOCATIONS_NONE) {
+        line_number = loc.line_number + 1;
+        column_number = loc.column_number;
+        if (line_number != 8) {
+            fprintf (stderr, "line number %lu != 8\n", line_number);
+            return 1;
+        }
+
+        if (column_number != 33) {
+            fprintf (stderr, "column number %lu != 33\n", column_number);
+            return 1;
+        }
+
+        if (loc.line_offset != 135) {
+            fprintf (stderr, "line offset %lu != 135\n", loc.line_offset);
+            return 1;
+        }
+    }
+
+    n = j65_find_key (&tree, tree.root, "banana");
+    if (n != NULL) {
+        fprintf (stderr, "found banana but shouldn't have\n");
         return 1;
     }
 
-    if (column_number != 33) {
-        fprintf (stderr, "column number %lu != 33\n", column_number);
+    j65_free_tree (&tree);
+
+    if (arena != NULL && (arena1.used != 0 || arena2.used != 0)) {
+        fprintf (stderr, "arena not reset by j65_free_tree\n");
         return 1;
     }
 
-    if (n->location.line_offset != 135) {
-        fprintf (stderr, "line offset %lu != 135\n", n->location.line_offset);
+    return 0;
+}
+
+/* An object with 40 keys (plus a duplicate), so j65_find_key() builds
+   a key index for it.  Keys must still be found, and the first of
+   two duplicate keys must win, as without the index. */
+static int index_test (void) {
+    static char json[512];
+    char key[8];
+    int8_t status;
+    j65_node *n;
+    uint8_t pass, i;
+
+    strcpy (json, "{");
+    for (i = 0; i < 40; i++) {
+        sprintf (json + strlen (json), "\"k%u\": %u, ", i, i);
+    }
+    strcat (json, "\"k7\": 99}");
+
+    j65_init_tree (&tree);
+    j65_init (&parser, &tree, j65_tree_callback, 255);
+    status = j65_parse (&parser, json, strlen (json));
+    if (status != J65_DONE) {
+        fprintf (stderr, "index: j65_parse returned status %d\n", status);
         return 1;
     }
 
-    n = j65_find_key (&tree, tree.root, "banana");
-    if (n != NULL) {
-        fprintf (stderr, "found banana but shouldn't have\n");
+    /* the first pass builds the index, and the second uses it */
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < 40; i++) {
+            sprintf (key, "k%u", i);
+            n = j65_find_key (&tree, tree.root, key);
+            if (n == NULL || n->child->integer != i) {
+                fprintf (stderr, "index: couldn't find %s\n", key);
+                return 1;
+            }
+        }
+
+        if (j65_find_key (&tree, tree.root, "k40") != NULL) {
+            fprintf (stderr, "index: found k40 but shouldn't have\n");
+            return 1;
+        }
+    }
+
+    if (tree.root->index == NULL) {
+        fprintf (stderr, "index: no index was built\n");
         return 1;
     }
 
@@ -99,6 +172,176 @@ static int do_test (size_t len) {
     return 0;
 }
 
+/* Elements of an array of 50 integers, with and without a vector. */
+static int array_test (void) {
+    static char json[256];
+    int8_t status;
+    j65_node *n;
+    uint8_t pass, i;
+
+    strcpy (json, "[");
+    for (i = 0; i < 50; i++) {
+        sprintf (json + strlen (json), "%u,", i);
+    }
+    strcat (json, "[]]");
+
+    j65_init_tree (&tree);
+    j65_init (&parser, &tree, j65_tree_callback, 255);
+    status = j65_parse (&parser, json, strlen (json));
+    if (status != J65_DONE) {
+        fprintf (stderr, "array: j65_parse returned status %d\n", status);
+        return 1;
+    }
+
+    if (j65_array_length (tree.root) != 51) {
+        fprintf (stderr, "array: length %u != 51\n",
+                 (unsigned) j65_array_length (tree.root));
+        return 1;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < 50; i++) {
+            n = j65_array_get (tree.root, i);
+            if (n == NULL || n->integer != i) {
+                fprintf (stderr, "array: element %u is wrong\n", i);
+                return 1;
+            }
+        }
+
+        n = j65_array_get (tree.root, 50);
+        if (n == NULL || j65_array_length (n) != 0 ||
+            j65_array_get (n, 0) != NULL ||
+            j65_array_get (tree.root, 51) != NULL) {
+            fprintf (stderr, "array: bad end of array\n");
+            return 1;
+        }
+
+        if (j65_index_array (&tree, tree.root) != 0 ||
+            j65_index_array (&tree, n) != 0) {
+            fprintf (stderr, "array: j65_index_array failed\n");
+            return 1;
+        }
+    }
+
+    j65_free_tree (&tree);
+    return 0;
+}
+
+/* Record-at-a-time mode, with 20 records in {"items": [...]}, in an
+   arena which is only big enough for a couple of them at a time. */
+static uint8_t record_count, record_bad;
+
+static int8_t record_callback (j65_tree *t, j65_node *record) {
+    char name[8];
+    j65_node *n;
+
+    if (record->node_type == J65_NULL) { /* the last one */
+        record_count++;
+        return 0;
+    }
+
+    sprintf (name, "r%u", record_count);
+    n = j65_find_key (t, record, "id");
+    if (n == NULL || n->child->integer != record_count)
+        record_bad++;
+    n = j65_find_key (t, record, "name");
+    if (n == NULL || strcmp (n->child->string, name) != 0)
+        record_bad++;
+
+    /* the enclosing array is still being parsed, so it isn't indexed */
+    if (j65_index_array (t, record->parent) != 0 ||
+        record->parent->elements != NULL)
+        record_bad++;
+
+    record_count++;
+    return 0;
+}
+
+static int record_test (j65_arena *arena) {
+    static char json[640];
+    int8_t status;
+    j65_node *n;
+    uint8_t i;
+
+    strcpy (json, "{\"items\": [");
+    for (i = 0; i < 20; i++) {
+        sprintf (json + strlen (json), "{\"id\": %u, \"name\": \"r%u\"}, ",
+                 i, i);
+    }
+    strcat (json, "null]}");
+
+    record_count = record_bad = 0;
+    if (arena != NULL)
+        j65_init_tree_arena (&tree, arena);
+    else
+        j65_init_tree (&tree);
+    j65_set_tree_records (&tree, 2, record_callback);
+    j65_init (&parser, &tree, j65_tree_callback, 255);
+    status = j65_parse (&parser, json, strlen (json));
+    if (status != J65_DONE) {
+        fprintf (stderr, "records: j65_parse returned status %d\n", status);
+        return 1;
+    }
+
+    if (record_count != 21 || record_bad != 0) {
+        fprintf (stderr, "records: %u records, %u bad\n",
+                 record_count, record_bad);
+        return 1;
+    }
+
+    n = j65_find_key (&tree, tree.root, "items");
+    if (n == NULL || j65_array_length (n->child) != 21 ||
+        n->child->child != NULL) {
+        fprintf (stderr, "records: items array is wrong\n");
+        return 1;
+    }
+
+    /* the records are counted, but there are none left to index */
+    if (j65_index_array (&tree, n->child) != 0 ||
+        j65_array_get (n->child, 0) != NULL) {
+        fprintf (stderr, "records: items array was indexed\n");
+        return 1;
+    }
+
+    j65_free_tree (&tree);
+    return 0;
+}
+
+/* CR, LF, and CRLF each end one line. */
+static int location_test (void) {
+    static const char text[] = "a\r\nb\rc\nde";
+    j65_source_location loc;
+
+    j65_find_location (text, 8, &loc);
+    if (loc.line_number != 3 || loc.column_number != 1 ||
+        loc.line_offset != 7) {
+        fprintf (stderr, "location %lu/%lu/%lu != 3/1/7\n",
+                 loc.line_number, loc.column_number, loc.line_offset);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* An arena which is too small should cause J65_OUT_OF_MEMORY. */
+static int small_arena_test (size_t len) {
+    int8_t status;
+
+    j65_init_arena (&arena1, arena_nodes1, sizeof (arena_nodes1));
+    j65_init_tree_arena (&tree, &arena1);
+    j65_init (&parser, &tree, j65_tree_callback, 255);
+    status = j65_parse (&parser, buf, len);
+    j65_free_tree (&tree);
+
+    if (status != J65_OUT_OF_MEMORY) {
+        fprintf (stderr, "small arena: status %d != %d\n",
+                 status, J65_OUT_OF_MEMORY);
+        return 1;
+    }
+
+    return 0;
+}
+
 int main (int argc, char **argv) {
     FILE *f;
     int badness = 0;
@@ -118,7 +361,32 @@ int main (int argc, char **argv) {
 
     fclose (f);
 
-    badness = do_test (len);
+    badness = do_test (len, NULL, J65_LOCATIONS_FULL);
+    badness += do_test (len, NULL, J65_LOCATIONS_OFFSET);
+    badness += do_test (len, NULL, J65_LOCATIONS_NONE);
+
+    j65_init_arena (&arena1, arena_nodes1, sizeof (arena_nodes1));
+    j65_init_arena (&arena2, arena_nodes2, sizeof (arena_nodes2));
+    arena1.next = &arena2;
+    /* twice, to make sure the arena can be reused */
+    badness += do_test (len, &arena1, J65_LOCATIONS_FULL);
+    badness += do_test (len, &arena1, J65_LOCATIONS_FULL);
+
+    /* an arena just big enough for 37 compact nodes */
+    j65_init_arena (&arena2, arena_nodes2,
+                    37 * j65_node_size (J65_LOCATIONS_NONE));
+    badness += do_test (len, &arena2, J65_LOCATIONS_NONE);
+
+    badness += small_arena_test (len);
+    badness += location_test ();
+    badness += index_test ();
+    badness += array_test ();
+
+    /* 10 nodes is enough for one record (5 nodes), plus the 3 nodes
+       enclosing the records, but not for two records */
+    j65_init_arena (&arena1, arena_nodes1, sizeof (arena_nodes1));
+    badness += record_test (&arena1);
+    badness += record_test (NULL);
 
     if (badness == 0)
         fprintf (stderr, "Success!\n");
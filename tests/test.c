@@ -32,6 +32,23 @@ static char buf[80];
 
 #define MAGIC 0x2badbeef
 
+/* run-tests.pl also builds this with each of the json65.s build
+   options defined, which changes what some of the tests expect. */
+#if defined(J65_NO_INTEGER_CONVERSION)
+#define INTEGER_EVENT(i) J65_NUMBER
+#elif defined(J65_INT16)
+#define INTEGER_EVENT(i) \
+    ((i) >= -32768L && (i) <= 32767L ? J65_INTEGER : J65_NUMBER)
+#else
+#define INTEGER_EVENT(i) J65_INTEGER
+#endif
+
+#ifdef J65_NO_POSITIONS
+#define LINE(n) 0
+#else
+#define LINE(n) (n)
+#endif
+
 typedef struct {
     int8_t ev;
     int32_t integer;
@@ -331,6 +348,27 @@ static const event_check test48[] = {
     { J65_STRING,            0, "comma",          0, 1 },
 };
 
+static const event_check test49[] = {
+    { J65_PARSE_ERROR, 49, "[4294967296, -0, 12e3, 1-2]", 0, 0 },
+    { J65_START_ARRAY,       0, NULL,             0, 1 },
+    { J65_NUMBER,            0, "4294967296",     0, 1 },
+    { J65_INTEGER,           0, "-0",             0, 1 },
+    { J65_NUMBER,            0, "12e3",           0, 1 },
+};
+
+static const event_check test50[] = {
+    { J65_PARSE_ERROR, 50, "[null,false,true,nulls]", 0, 0 },
+    { J65_START_ARRAY,       0, NULL,             0, 1 },
+    { J65_NULL,              0, NULL,             0, 1 },
+    { J65_FALSE,             0, NULL,             0, 1 },
+    { J65_TRUE,              0, NULL,             0, 1 },
+};
+
+static const event_check test51[] = {
+    { J65_DONE, 51, "\"\\uD834!\\uD834\\uD834\\uDD1E\\uDD1E\\\\\"", 0, 0 },
+    { J65_STRING,          0, "\xed\xa0\xb4!\xed\xa0\xb4𝄞\xed\xb4\x9e\\", 0, 0 },
+};
+
 static const char *event_name (uint8_t event) {
     switch (event) {
     case J65_NULL        : return "J65_NULL";
@@ -344,6 +382,8 @@ static const char *event_name (uint8_t event) {
     case J65_END_OBJ     : return "J65_END_OBJ";
     case J65_START_ARRAY : return "J65_START_ARRAY";
     case J65_END_ARRAY   : return "J65_END_ARRAY";
+    case J65_STRING_PART : return "J65_STRING_PART";
+    case J65_KEY_PART    : return "J65_KEY_PART";
     default: return "?";
     }
 }
@@ -368,6 +408,7 @@ static int8_t callback (j65_parser *p, uint8_t event) {
     size_t len1, len2;
     uint32_t line_no;
     uint8_t depth;
+    int8_t ev;
 
     if (ctx->magic != MAGIC) {
         print_fail();
@@ -383,10 +424,15 @@ static int8_t callback (j65_parser *p, uint8_t event) {
 
     ec = ctx->events + pos;
 
-    if (ec->ev != event) {
+    ev = ec->ev;
+    if (ev == J65_INTEGER) {
+        ev = INTEGER_EVENT (ec->integer);
+    }
+
+    if (ev != event) {
         print_fail();
         printf ("[%u] Got %s but expected %s\n",
-                pos, ename, event_name(ec->ev));
+                pos, ename, event_name(ev));
         return J65_USER_ERROR;
     }
 
@@ -421,10 +467,10 @@ static int8_t callback (j65_parser *p, uint8_t event) {
     }
 
     line_no = j65_get_line_number(p);
-    if (line_no != ec->line_no) {
+    if (line_no != LINE (ec->line_no)) {
         print_fail();
         printf ("[%u] For %s, got line %lu but expected %lu\n",
-                pos, ename, line_no, ec->line_no);
+                pos, ename, line_no, LINE (ec->line_no));
         return J65_USER_ERROR;
     }
 
@@ -444,11 +490,19 @@ static int8_t callback (j65_parser *p, uint8_t event) {
 static void run_test (const event_check *events, size_t len) {
     my_context ctx;
     uint32_t line_no;
+    size_t consumed;
     int8_t ret;
     const char *str = events->str;
 
     printf ("test %02ld: ", events->integer);
 
+#ifdef J65_NO_UNICODE_ESCAPES
+    if (strstr (str, "\\u") != NULL) {
+        printf ("skipped\n");
+        return;
+    }
+#endif
+
     ctx.magic = MAGIC;
     ctx.events = events;
     ctx.len = len;
@@ -475,10 +529,30 @@ static void run_test (const event_check *events, size_t len) {
     }
 
     line_no = j65_get_line_number(&parser);
-    if (line_no != events->line_no) {
+    if (line_no != LINE (events->line_no)) {
         print_fail();
         printf ("Final line number was %lu but expected %lu\n",
-                line_no, events->line_no);
+                line_no, LINE (events->line_no));
+        return;
+    }
+
+    /* Validating should end the same way, at the same place. */
+    consumed = j65_get_consumed (&parser);
+    j65_init_validate (&parser, 4);
+    ret = j65_parse(&parser, str, strlen(str));
+
+    if (ret != events->ev) {
+        print_fail();
+        printf ("Validating returned %d but expected %d\n", ret, events->ev);
+        return;
+    }
+
+    if (j65_get_consumed (&parser) != consumed ||
+        j65_get_line_number (&parser) != line_no) {
+        print_fail();
+        printf ("Validating ended at %u (line %lu) but expected %u\n",
+                j65_get_consumed (&parser), j65_get_line_number (&parser),
+                consumed);
         return;
     }
 
@@ -502,6 +576,772 @@ static void depth_test (uint8_t specified, uint8_t expected) {
     }
 }
 
+static int8_t ignore_events (j65_parser *p, uint8_t event) {
+    return 0;
+}
+
+/* Parses str1 followed by str2, in two separate calls to j65_parse(),
+   and then checks the final position. */
+static void position_test (const char *str1, const char *str2,
+                           uint32_t line_no, uint32_t col_no) {
+    uint32_t actual_line, actual_col;
+    int8_t ret;
+
+    printf ("%-18s", "position test:");
+
+    j65_init (&parser, NULL, ignore_events, 0);
+    ret = j65_parse (&parser, str1, strlen (str1));
+    if (ret == J65_WANT_MORE) {
+        ret = j65_parse (&parser, str2, strlen (str2));
+    }
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+        return;
+    }
+
+    actual_line = j65_get_line_number (&parser);
+    actual_col = j65_get_column_number (&parser);
+    if (actual_line != line_no || actual_col != col_no) {
+        print_fail ();
+        printf ("Got %lu:%lu but expected %lu:%lu\n",
+                actual_line, actual_col, line_no, col_no);
+    } else {
+        print_pass ();
+    }
+}
+
+static char stream_json[400];
+static char stream_expected[400];
+static char stream_actual[400];
+static size_t stream_len;
+static uint8_t stream_parts;
+
+static int8_t stream_callback (j65_parser *p, uint8_t event) {
+    uint8_t len;
+
+    if (event == J65_STRING_PART || event == J65_STRING) {
+        len = j65_get_length (p);
+        if (stream_len + len <= sizeof (stream_actual)) {
+            memcpy (stream_actual + stream_len, j65_get_string (p), len);
+        }
+        stream_len += len;
+        if (event == J65_STRING_PART) {
+            stream_parts++;
+        }
+    }
+
+    return 0;
+}
+
+/* Parses a string which is too long for the string buffer, with
+   J65_STREAM_STRINGS turned on.  The input is split in the middle
+   of a \u escape, so the escape has to be decoded across chunks. */
+static void stream_test (void) {
+#ifdef J65_NO_UNICODE_ESCAPES
+    static const char escapes[] = "\\/\\\\\\n";
+    static const char unescaped[] = "/\\\n";
+#else
+    static const char escapes[] = "\\u00e9\\\\\\n";
+    static const char unescaped[] = "\xc3\xa9\\\n";
+#endif
+    size_t json_len, expected_len;
+    int8_t ret;
+
+    printf ("%-18s", "stream test:");
+
+    json_len = 0;
+    stream_json[json_len++] = '"';
+    memset (stream_json + json_len, 'a', 250);
+    json_len += 250;
+    strcpy (stream_json + json_len, escapes);
+    json_len += strlen (escapes);
+    memset (stream_json + json_len, 'b', 100);
+    json_len += 100;
+    stream_json[json_len++] = '"';
+
+    memset (stream_expected, 'a', 250);
+    expected_len = 250;
+    strcpy (stream_expected + expected_len, unescaped);
+    expected_len += strlen (unescaped);
+    memset (stream_expected + expected_len, 'b', 100);
+    expected_len += 100;
+
+    stream_len = 0;
+    stream_parts = 0;
+    j65_init (&parser, NULL, stream_callback, 0);
+    j65_set_options (&parser, J65_STREAM_STRINGS);
+    ret = j65_parse (&parser, stream_json, 254);
+    if (ret == J65_WANT_MORE) {
+        ret = j65_parse (&parser, stream_json + 254, json_len - 254);
+    }
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+    } else if (stream_parts != 1) {
+        print_fail ();
+        printf ("Got %u parts but expected 1\n", stream_parts);
+    } else if (stream_len != expected_len ||
+               memcmp (stream_actual, stream_expected, expected_len) != 0) {
+        print_fail ();
+        printf ("Got wrong string (length %u)\n", stream_len);
+    } else {
+        print_pass ();
+    }
+}
+
+static uint8_t skip_events[16];
+static uint8_t skip_count;
+
+/* Skips the values of keys "a" and "c", and any object at depth 2. */
+static int8_t skip_callback (j65_parser *p, uint8_t event) {
+    const char *str;
+
+    if (skip_count < sizeof (skip_events)) {
+        skip_events[skip_count] = event;
+    }
+    skip_count++;
+
+    if (event == J65_KEY) {
+        str = j65_get_string (p);
+        if (strcmp (str, "a") == 0 || strcmp (str, "c") == 0) {
+            return J65_SKIP;
+        }
+    } else if (event == J65_START_OBJ && j65_get_current_depth (p) == 2) {
+        return J65_SKIP;
+    }
+
+    return 0;
+}
+
+static void skip_test (const char *json, int8_t expected_ret,
+                       const uint8_t *expected, uint8_t expected_count) {
+    int8_t ret;
+
+    printf ("%-18s", "skip test:");
+
+    skip_count = 0;
+    j65_init (&parser, NULL, skip_callback, 0);
+    ret = j65_parse (&parser, json, strlen (json));
+
+    if (ret != expected_ret) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, expected_ret);
+    } else if (skip_count != expected_count ||
+               memcmp (skip_events, expected, expected_count) != 0) {
+        print_fail ();
+        printf ("Got %u events but expected %u\n", skip_count, expected_count);
+    } else {
+        print_pass ();
+    }
+}
+
+static const uint8_t skip00[] = {
+    J65_START_OBJ, J65_KEY, J65_KEY, J65_KEY, J65_START_OBJ,
+    J65_KEY, J65_TRUE, J65_END_OBJ,
+};
+
+static const uint8_t skip01[] = {
+    J65_START_ARRAY, J65_START_OBJ,
+};
+
+static char deep_json[1100];
+static uint8_t deep_events[16];
+static uint8_t deep_count;
+static uint16_t deep_total;
+
+/* Skips the values of keys "a", "s", and "d", and any array at depth
+   255, keeping the events at depths 254 and 255. */
+static int8_t deep_skip_callback (j65_parser *p, uint8_t event) {
+    uint8_t depth = j65_get_current_depth (p);
+    const char *str;
+
+    deep_total++;
+    if (depth < 254) {
+        return 0;
+    }
+
+    if (deep_count < sizeof (deep_events)) {
+        deep_events[deep_count] = event;
+    }
+    deep_count++;
+
+    if (event == J65_KEY) {
+        str = j65_get_string (p);
+        if (strcmp (str, "a") == 0 || strcmp (str, "s") == 0 ||
+            strcmp (str, "d") == 0) {
+            return J65_SKIP;
+        }
+    } else if (event == J65_START_ARRAY && depth == 255) {
+        return J65_SKIP;
+    }
+
+    return 0;
+}
+
+static const uint8_t deep_skip00[] = {
+    J65_START_OBJ, J65_KEY, J65_KEY, J65_START_OBJ, J65_KEY, J65_KEY,
+    INTEGER_EVENT(2), J65_END_OBJ, J65_KEY, J65_START_ARRAY, J65_KEY,
+    J65_END_OBJ,
+};
+
+/* Nests arrays and objects 255 deep, and skips at the deepest levels,
+   where stack_idx is close to 0. */
+static void deep_skip_test (void) {
+    char *s = deep_json;
+    uint8_t i;
+    int8_t ret;
+
+    printf ("%-18s", "deep skip test:");
+
+    for (i = 1; i < 254; i++) {
+        if (i & 1) {
+            *s++ = '[';
+        } else {
+            strcpy (s, "{\"k\":");
+            s += 5;
+        }
+    }
+    strcpy (s, "{\"a\": [4, 5], \"b\": {\"s\": 1, \"t\": 2}, "
+            "\"c\": [3], \"d\": {\"e\": 6}}");
+    s += strlen (s);
+    for (i = 253; i > 0; i--) {
+        *s++ = (i & 1) ? ']' : '}';
+    }
+
+    deep_count = 0;
+    deep_total = 0;
+    j65_init (&parser, NULL, deep_skip_callback, 0);
+    ret = j65_parse (&parser, deep_json, s - deep_json);
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+    } else if (deep_total != 644 || deep_count != sizeof (deep_skip00) ||
+               memcmp (deep_events, deep_skip00, deep_count) != 0) {
+        print_fail ();
+        printf ("Got %u events (%u deep) but expected 644 (%u deep)\n",
+                deep_total, deep_count, (unsigned) sizeof (deep_skip00));
+    } else {
+        print_pass ();
+    }
+}
+
+static uint8_t handled_strings, handled_keys;
+
+static int8_t handle_string (j65_parser *p, uint8_t event) {
+    handled_strings++;
+    return 0;
+}
+
+static int8_t handle_key (j65_parser *p, uint8_t event) {
+    handled_keys++;
+    return 0;
+}
+
+static void handlers_test (void) {
+    static j65_callback handlers[J65_NUM_EVENTS];
+    static const char json[] = "{\"a\": [\"x\", 1, null], \"b\": \"y\"}";
+    int8_t ret;
+
+    printf ("%-18s", "handlers test:");
+
+    handlers[J65_STRING] = handle_string;
+    handlers[J65_KEY] = handle_key;
+    handled_strings = handled_keys = 0;
+    j65_init_handlers (&parser, NULL, handlers, 0);
+    ret = j65_parse (&parser, json, strlen (json));
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+    } else if (handled_strings != 2 || handled_keys != 2) {
+        print_fail ();
+        printf ("Got %u strings and %u keys but expected 2 and 2\n",
+                handled_strings, handled_keys);
+    } else {
+        print_pass ();
+    }
+}
+
+static uint8_t ring_buf[280];
+static j65_ring ring;
+static uint8_t ring_events[16];
+static uint8_t ring_count;
+
+/* Removes all the records from the ring, checking the integers and
+   the string length as it goes.  Returns nonzero if a record is wrong. */
+static uint8_t drain_ring (void) {
+    const uint8_t *rec;
+    uint8_t len, bad = 0;
+    int32_t i;
+
+    while (ring.tail != ring.head) {
+        rec = ring.buf + ring.tail;
+        if (ring.tail == ring.size || rec[0] == J65_RING_WRAP) {
+            ring.tail = 0;
+            continue;
+        }
+
+        if (ring_count < sizeof (ring_events)) {
+            ring_events[ring_count] = rec[0];
+        }
+        ring_count++;
+
+        len = rec[1];
+        if (rec[0] == J65_INTEGER) {
+            memcpy (&i, rec + 2, sizeof (i));
+            if (i != 1 && i != -5) {
+                bad = 1;
+            }
+            rec += 4;
+            ring.tail += 4;
+        } else if (rec[0] == J65_STRING && len != 250) {
+            bad = 1;
+        }
+
+        if (rec[2 + len] != 0) {
+            bad = 1;
+        }
+        ring.tail += 3 + len;
+    }
+
+    return bad;
+}
+
+/* Parses into a ring which is too small to hold all of the events,
+   so it has to be drained in the middle. */
+static void ring_test (void) {
+    static const uint8_t expected[] = {
+        J65_START_OBJ, J65_KEY, J65_START_ARRAY, INTEGER_EVENT (1),
+        J65_STRING, J65_TRUE, INTEGER_EVENT (-5), J65_END_ARRAY, J65_KEY,
+        J65_NULL, J65_END_OBJ,
+    };
+    static char json[300];
+    const char *str;
+    size_t len, consumed;
+    uint8_t fulls = 0, bad = 0;
+    int8_t ret;
+
+    printf ("%-18s", "ring test:");
+
+    strcpy (json, "{\"key\": [1, \"");
+    len = strlen (json);
+    memset (json + len, 'x', 250);
+    strcpy (json + len + 250, "\", true, -5], \"k2\": null}");
+
+    ring.buf = ring_buf;
+    ring.size = sizeof (ring_buf);
+    ring.head = ring.tail = 0;
+    ring_count = 0;
+    j65_init_ring (&parser, NULL, &ring, 0);
+
+    str = json;
+    len = strlen (json);
+    ret = j65_parse (&parser, str, len);
+    while (ret == J65_RING_FULL) {
+        fulls++;
+        consumed = j65_get_consumed (&parser);
+        str += consumed;
+        len -= consumed;
+        bad |= drain_ring ();
+        ret = j65_parse (&parser, str, len);
+    }
+    bad |= drain_ring ();
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+    } else if (fulls == 0) {
+        print_fail ();
+        printf ("Ring never filled up\n");
+    } else if (bad || ring_count != sizeof (expected) ||
+               memcmp (ring_events, expected, sizeof (expected)) != 0) {
+        print_fail ();
+        printf ("Got wrong records (%u of them)\n", ring_count);
+    } else {
+        print_pass ();
+    }
+}
+
+static const char borrow_json[] =
+    "{\"abc\": \"x\\ny\", \"de\": \"fgh\"}";
+static uint8_t borrowed, copied, borrow_bad;
+
+static int8_t borrow_callback (j65_parser *p, uint8_t event) {
+    const char *view;
+    uint8_t len;
+
+    if (event == J65_STRING || event == J65_KEY) {
+        view = j65_get_view (p);
+        len = j65_get_length (p);
+        if (j65_is_borrowed (p)) {
+            borrowed++;
+            if (view < borrow_json ||
+                view + len > borrow_json + sizeof (borrow_json)) {
+                borrow_bad = 1;
+            }
+        } else {
+            copied++;
+        }
+        if (memcmp (view, j65_get_string (p), len) != 0) {
+            borrow_bad = 1;
+        }
+    }
+
+    return 0;
+}
+
+/* With J65_BORROW_STRINGS, only the string with an escape in it
+   should be copied into the string buffer. */
+static void borrow_test (void) {
+    int8_t ret;
+
+    printf ("%-18s", "borrow test:");
+
+    borrowed = copied = borrow_bad = 0;
+    j65_init (&parser, NULL, borrow_callback, 0);
+    j65_set_options (&parser, J65_BORROW_STRINGS);
+    ret = j65_parse (&parser, borrow_json, strlen (borrow_json));
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+    } else if (borrow_bad || borrowed != 3 || copied != 1) {
+        print_fail ();
+        printf ("Got %u borrowed and %u copied but expected 3 and 1\n",
+                borrowed, copied);
+    } else {
+        print_pass ();
+    }
+}
+
+static uint32_t reset_lines[4];
+static uint8_t reset_count;
+
+static int8_t reset_callback (j65_parser *p, uint8_t event) {
+    if (event == INTEGER_EVENT (0) && reset_count < 4) {
+        reset_lines[reset_count++] = j65_get_line_number (p);
+    }
+
+    return 0;
+}
+
+/* Parses three JSON values from one buffer, resetting the parser in
+   between, and keeping the line numbers running. */
+static void reset_test (void) {
+    static const char json[] = "{\"a\": 1}\r\n[2]\r\n3\r\n";
+    const char *str;
+    size_t len, consumed;
+    uint8_t records = 0;
+    int8_t ret;
+
+    printf ("%-18s", "reset test:");
+
+    reset_count = 0;
+    j65_init (&parser, NULL, reset_callback, 0);
+    str = json;
+    len = strlen (json);
+    while (len > 0) {
+        ret = j65_parse (&parser, str, len);
+        if (ret != J65_DONE) {
+            break;
+        }
+        records++;
+        consumed = j65_get_consumed (&parser);
+        str += consumed;
+        len -= consumed;
+        j65_reset (&parser, 1);
+    }
+
+    if (ret != J65_WANT_MORE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_WANT_MORE);
+    } else if (records != 3 || reset_count != 3) {
+        print_fail ();
+        printf ("Got %u records but expected 3\n", records);
+    } else if (reset_lines[0] != 0 || reset_lines[1] != LINE (1) ||
+               reset_lines[2] != LINE (2)) {
+        print_fail ();
+        printf ("Got wrong line numbers\n");
+    } else {
+        print_pass ();
+    }
+}
+
+/* Parses json as a stream of records with J65_RECOVER on, resetting
+   the parser after each one, and compares the status of each call to
+   j65_parse with expected.  Prints the failure and returns 1 if they
+   differ. */
+static uint8_t parse_records (const char *json, j65_callback cb,
+                              const int8_t *expected, uint8_t expected_count) {
+    int8_t results[8];
+    const char *str;
+    size_t len, consumed;
+    uint8_t count = 0;
+    int8_t ret;
+
+    j65_init (&parser, NULL, cb, 0);
+    j65_set_options (&parser, J65_RECOVER);
+    str = json;
+    len = strlen (json);
+    while (len > 0 && count < sizeof (results)) {
+        ret = j65_parse (&parser, str, len);
+        if (ret == J65_WANT_MORE) {
+            break;
+        }
+        results[count++] = ret;
+        consumed = j65_get_consumed (&parser);
+        str += consumed;
+        len -= consumed;
+        if (ret == J65_DONE) {
+            j65_reset (&parser, 1);
+        }
+    }
+
+    if (count != expected_count ||
+        memcmp (results, expected, expected_count) != 0) {
+        print_fail ();
+        printf ("Got %u wrong results\n", count);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Parses a stream of records with J65_RECOVER on.  The second and
+   fourth records are bad, and should be skipped. */
+static void recover_test (void) {
+    static const int8_t expected[] = {
+        J65_DONE, J65_ILLEGAL_CHAR, J65_DONE, J65_EXPECTED_ARRAY_END,
+        J65_DONE,
+    };
+
+    printf ("%-18s", "recover test:");
+
+    reset_count = 0;
+    if (parse_records ("{\"a\": 1}\n{\"b\": x}\n[3]{\"c\": [}]\n4\n",
+                       reset_callback, expected, sizeof (expected))) {
+        return;
+    }
+
+    if (reset_count != 3 || reset_lines[2] != LINE (3)) {
+        print_fail ();
+        printf ("Got wrong integers\n");
+    } else {
+        print_pass ();
+    }
+}
+
+static uint8_t start_error_ints;
+
+static int8_t start_error_callback (j65_parser *p, uint8_t event) {
+    if (event == J65_START_ARRAY && j65_get_current_depth (p) == 2) {
+        return J65_USER_ERROR;
+    }
+    if (event == INTEGER_EVENT (0)) {
+        start_error_ints++;
+    }
+
+    return 0;
+}
+
+/* With J65_RECOVER on, the callback fails on the '[' of the first
+   record, which has no newline after it.  That '[' must only be
+   counted once, or the next record would be skipped, too. */
+static void recover_start_test (void) {
+    static const int8_t expected[] = {
+        J65_USER_ERROR, J65_DONE, J65_DONE,
+    };
+
+    printf ("%-18s", "recover start:");
+
+    start_error_ints = 0;
+    if (parse_records ("{\"a\": [1]}{\"b\": 2}[3]", start_error_callback,
+                       expected, sizeof (expected))) {
+        return;
+    }
+
+    if (start_error_ints != 2) {
+        print_fail ();
+        printf ("Got %u integers but expected 2\n", start_error_ints);
+    } else {
+        print_pass ();
+    }
+}
+
+static uint8_t yield_twos;
+
+static int8_t yield_callback (j65_parser *p, uint8_t event) {
+    if (event == INTEGER_EVENT (2) && strcmp (j65_get_string (p), "2") == 0) {
+        yield_twos++;
+    }
+
+    return J65_YIELD;
+}
+
+/* The callback yields after every event, so j65_parse has to be
+   called once per event. */
+static void yield_test (void) {
+    static const char json[] = "[1, {\"a\": 2}, null]";
+    const char *str;
+    size_t len, consumed;
+    uint8_t yields = 0;
+    int8_t ret;
+
+    printf ("%-18s", "yield test:");
+
+    yield_twos = 0;
+    j65_init (&parser, NULL, yield_callback, 0);
+    str = json;
+    len = strlen (json);
+    ret = j65_parse (&parser, str, len);
+    while (ret == J65_YIELD) {
+        yields++;
+        consumed = j65_get_consumed (&parser);
+        str += consumed;
+        len -= consumed;
+        ret = j65_parse (&parser, str, len);
+    }
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+    } else if (yields != 7) {
+        print_fail ();
+        printf ("Got %u yields but expected 7\n", yields);
+    } else if (yield_twos != 1) {
+        print_fail ();
+        printf ("Got the integer 2 %u times but expected once\n", yield_twos);
+    } else {
+        print_pass ();
+    }
+}
+
+/* A top-level scalar is the last event, so yielding on it still makes
+   j65_parse return J65_DONE. */
+static void scalar_yield_test (const char *json) {
+    int8_t ret;
+
+    printf ("%-18s", "scalar yield:");
+
+    j65_init (&parser, NULL, yield_callback, 0);
+    ret = j65_parse (&parser, json, strlen (json));
+
+    if (ret != J65_DONE) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, J65_DONE);
+    } else if (j65_get_consumed (&parser) != strlen (json)) {
+        print_fail ();
+        printf ("Consumed %u bytes but expected %u\n",
+                (unsigned) j65_get_consumed (&parser),
+                (unsigned) strlen (json));
+    } else {
+        print_pass ();
+    }
+}
+
+/* Parses json with J65_CHECK_UTF8 on, first all at once and then one
+   byte at a time, so that characters are split between chunks.  Both
+   ways should return expected_ret, with the error (if any) at offset
+   expected_pos. */
+static void utf8_test (const char *json, int8_t expected_ret,
+                       size_t expected_pos) {
+    size_t len = strlen (json);
+    size_t pos;
+    uint8_t pass;
+    int8_t ret;
+
+    printf ("%-18s", "utf8 test:");
+
+    for (pass = 0; pass < 2; pass++) {
+        j65_init (&parser, NULL, ignore_events, 0);
+        j65_set_options (&parser, J65_CHECK_UTF8);
+        if (pass == 0) {
+            ret = j65_parse (&parser, json, len);
+            pos = j65_get_consumed (&parser);
+        } else {
+            for (pos = 0; pos < len; pos++) {
+                ret = j65_parse (&parser, json + pos, 1);
+                if (ret != J65_WANT_MORE) {
+                    break;
+                }
+            }
+        }
+
+        if (ret != expected_ret) {
+            print_fail ();
+            printf ("Got return code %d but expected %d\n",
+                    ret, expected_ret);
+            return;
+        }
+
+        if (ret < 0 && pos != expected_pos) {
+            print_fail ();
+            printf ("Got error at %u but expected %u\n",
+                    (unsigned) pos, (unsigned) expected_pos);
+            return;
+        }
+    }
+
+    print_pass ();
+}
+
+/* A parser in a block of J65_PARSER_SIZE(4, 16) bytes, with guard
+   bytes on either side, which must not be touched. */
+#define SMALL_GUARD 8
+#define SMALL_SIZE J65_PARSER_SIZE (4, 16)
+static uint8_t small_block[SMALL_GUARD + SMALL_SIZE + SMALL_GUARD];
+static char small_string[20];
+
+static int8_t small_callback (j65_parser *p, uint8_t event) {
+    if (event == J65_STRING) {
+        strcpy (small_string, j65_get_string (p));
+    }
+
+    return 0;
+}
+
+static void small_test (const char *json, uint8_t options,
+                        int8_t expected_ret, const char *expected_string) {
+    j65_parser *p = (j65_parser *) (small_block + SMALL_GUARD);
+    uint8_t i;
+    int8_t ret;
+
+    printf ("%-18s", "small test:");
+
+    memset (small_block, 0xa5, sizeof (small_block));
+    small_string[0] = 0;
+    j65_init (p, NULL, small_callback, 4);
+    j65_set_options (p, options);
+    j65_set_max_length (p, 16);
+    ret = j65_parse (p, json, strlen (json));
+
+    for (i = 0; i < SMALL_GUARD; i++) {
+        if (small_block[i] != 0xa5 ||
+            small_block[SMALL_GUARD + SMALL_SIZE + i] != 0xa5) {
+            print_fail ();
+            printf ("Parser wrote outside of its %u bytes\n",
+                    (unsigned) SMALL_SIZE);
+            return;
+        }
+    }
+
+    if (ret != expected_ret) {
+        print_fail ();
+        printf ("Got return code %d but expected %d\n", ret, expected_ret);
+    } else if (expected_string != NULL &&
+               strcmp (small_string, expected_string) != 0) {
+        print_fail ();
+        printf ("Got string '%s' but expected '%s'\n",
+                small_string, expected_string);
+    } else {
+        print_pass ();
+    }
+}
+
 #define TEST(x) run_test (x, sizeof(x) / sizeof(x[0]))
 
 int main (int argc, char **argv) {
@@ -556,13 +1396,61 @@ int main (int argc, char **argv) {
     TEST(test46);
     TEST(test47);
     TEST(test48);
+    TEST(test49);
+    TEST(test50);
+    TEST(test51);
 
-    depth_test (0, 224);
+    depth_test (0, 255);
     depth_test (1, 1);
     depth_test (16, 16);
     depth_test (123, 123);
     depth_test (224, 224);
-    depth_test (255, 224);
+    depth_test (254, 254);
+    depth_test (255, 255);
+
+#ifndef J65_NO_POSITIONS
+    position_test ("[1,\r", "\n2]", 1, 2);
+    position_test ("[1,\r", "\n\n2]", 2, 2);
+    position_test ("[1,", "\r\r\n22]", 2, 3);
+#endif
+
+    stream_test ();
+
+    skip_test ("{\"a\": [1, {\"b\": 2}], \"c\": \"x\", "
+               "\"d\": {\"e\": [3]}, \"f\": true}",
+               J65_DONE, skip00, sizeof (skip00));
+    skip_test ("[{\"a\": [1, }]}]", J65_PARSE_ERROR, skip01, sizeof (skip01));
+    deep_skip_test ();
+
+    handlers_test ();
+    ring_test ();
+    borrow_test ();
+    reset_test ();
+    recover_test ();
+    recover_start_test ();
+    yield_test ();
+    scalar_yield_test ("1 ");
+    scalar_yield_test ("true\n");
+
+    utf8_test ("[\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\", "
+               "{\"\xf4\x8f\xbf\xbf\": \"\xed\x9f\xbf\"}]", J65_DONE, 0);
+    utf8_test ("[\"\xc0\x80\"]", J65_ILLEGAL_UTF8, 2);
+    utf8_test ("[\"\xe0\x80\x80\"]", J65_ILLEGAL_UTF8, 3);
+    utf8_test ("[\"\xed\xa0\x80\"]", J65_ILLEGAL_UTF8, 3);
+    utf8_test ("[\"\xf4\x90\x80\x80\"]", J65_ILLEGAL_UTF8, 3);
+    utf8_test ("[\"ab\x80\"]", J65_ILLEGAL_UTF8, 4);
+    utf8_test ("[\"\xe2\x82\"]", J65_ILLEGAL_UTF8, 4);
+    utf8_test ("[\"\xc3x\"]", J65_ILLEGAL_UTF8, 3);
+
+    small_test ("[[[\"0123456789abcdef\"]], true]", 0, J65_DONE,
+                "0123456789abcdef");
+    small_test ("[\"0123456789abcdefg\"]", 0, J65_STRING_TOO_LONG, NULL);
+    small_test ("[[[[\"\\t123456789abcdef\"]]]]", 0, J65_DONE,
+                "\t123456789abcdef");
+    small_test ("[[[[[1]]]]]", 0, J65_NESTING_TOO_DEEP, NULL);
+    small_test ("[\"ab\x80 a borrowed string much longer than sixteen "
+                "bytes, which must not be copied into strbuf\"]",
+                J65_BORROW_STRINGS | J65_CHECK_UTF8, J65_ILLEGAL_UTF8, NULL);
 
     if (failures > 0)
         color = 31;             /* red */